@@ -0,0 +1,549 @@
+#include <png/deflate.hpp>
+
+#include <algorithm>
+#include <queue>
+
+namespace png {
+    namespace deflate {
+        namespace {
+            const size_t WINDOW = 1 << 15;
+            const int MIN_MATCH = 3;
+            const int MAX_MATCH = 258;
+            const int HASH_BITS = 15;
+            const int MAX_BITS = 15;
+            const int MAX_CL_BITS = 7;
+            // Symbols per block: enough to amortize the dynamic tables, small
+            // enough for the tables to follow changes in the data.
+            const size_t BLOCK_SYMBOLS = 1 << 14;
+            const size_t MAX_STORED = 65535;
+
+            // Search effort per level, in the spirit of zlib's configuration table.
+            struct level_config {
+                int chain;   // candidates examined per position
+                int nice;    // stop searching once a match this long is found
+                bool lazy;   // try the next position before taking a match
+            };
+            const level_config LEVELS[10] = {
+                {0, 0, false}, {4, 8, false}, {8, 16, false}, {16, 32, false},
+                {16, 16, true}, {32, 32, true}, {128, 128, true},
+                {256, 258, true}, {1024, 258, true}, {4096, 258, true}
+            };
+
+            const uint16_t LEN_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                           35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            const uint8_t LEN_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                           3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            const uint16_t DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                            8193, 12289, 16385, 24577};
+            const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+            const uint8_t CL_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+            //! Length and distance to code lookups, plus the fixed Huffman code lengths.
+            struct tables {
+                uint8_t len_code[MAX_MATCH + 1];
+                uint8_t dist_code[512];
+                uint8_t fixed_lit[288];
+                uint8_t fixed_dist[30];
+                uint32_t crc[256];
+                tables() {
+                    for (int c = 0; c < 29; c++) {
+                        int end = c == 28 ? MAX_MATCH + 1 : LEN_BASE[c + 1];
+                        for (int l = LEN_BASE[c]; l < end; l++) {
+                            len_code[l] = c;
+                        }
+                    }
+                    // Distances up to 256 index directly, larger ones by (d - 1) >> 7.
+                    for (int c = 0; c < 30; c++) {
+                        int end = c == 29 ? 32769 : DIST_BASE[c + 1];
+                        for (int d = DIST_BASE[c]; d < end; d++) {
+                            if (d <= 256) {
+                                dist_code[d - 1] = c;
+                            } else {
+                                dist_code[256 + ((d - 1) >> 7)] = c;
+                            }
+                        }
+                    }
+                    for (int s = 0; s < 288; s++) {
+                        fixed_lit[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+                    }
+                    std::fill(fixed_dist, fixed_dist + 30, 5);
+                    for (uint32_t n = 0; n < 256; n++) {
+                        uint32_t c = n;
+                        for (int k = 0; k < 8; k++) {
+                            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                        }
+                        crc[n] = c;
+                    }
+                }
+                int dist_of(int d) const {
+                    return d <= 256 ? dist_code[d - 1] : dist_code[256 + ((d - 1) >> 7)];
+                }
+            };
+
+            const tables& table() {
+                static const tables t;
+                return t;
+            }
+
+            class bit_writer {
+            public:
+                explicit bit_writer(std::vector<uint8_t>& out) : out(out), bits(0), count(0) {}
+                void put(uint32_t value, int n) {
+                    bits |= (uint64_t) value << count;
+                    count += n;
+                    while (count >= 8) {
+                        out.push_back((uint8_t) bits);
+                        bits >>= 8;
+                        count -= 8;
+                    }
+                }
+                void align() {
+                    if (count > 0) {
+                        out.push_back((uint8_t) bits);
+                    }
+                    bits = 0;
+                    count = 0;
+                }
+                //! Stored block: header, alignment, LEN/NLEN and the raw bytes.
+                void stored(const uint8_t* data, size_t size, bool final) {
+                    put(final ? 1 : 0, 3);
+                    align();
+                    put((uint32_t) size, 16);
+                    put((uint32_t) (~size & 0xFFFF), 16);
+                    out.insert(out.end(), data, data + size);
+                }
+            private:
+                std::vector<uint8_t>& out;
+                uint64_t bits;
+                int count;
+            };
+
+            //! A literal (length 0) or a match of length 3..258 at distance 1..32768.
+            struct symbol {
+                uint16_t length;
+                uint16_t value;
+            };
+
+            //! Huffman code lengths for the given frequencies, limited to limit bits.
+            //!
+            //! At least two symbols always get a code so that every tree is complete.
+            void build_lengths(const uint32_t* freq, int n, int limit, uint8_t* lengths) {
+                std::vector<uint32_t> f(freq, freq + n);
+                int used = 0;
+                for (int s = 0; s < n; s++) {
+                    used += f[s] != 0;
+                }
+                for (int s = 0; used < 2 && s < n; s++) {
+                    if (f[s] == 0) {
+                        f[s] = 1;
+                        used++;
+                    }
+                }
+                for (;;) {
+                    typedef std::pair<uint64_t, int> node;
+                    std::priority_queue<node, std::vector<node>, std::greater<node> > heap;
+                    std::vector<int> parent(2 * n, -1);
+                    for (int s = 0; s < n; s++) {
+                        if (f[s] != 0) {
+                            heap.push(node(f[s], s));
+                        }
+                    }
+                    int next = n;
+                    while (heap.size() > 1) {
+                        node a = heap.top();
+                        heap.pop();
+                        node b = heap.top();
+                        heap.pop();
+                        parent[a.second] = parent[b.second] = next;
+                        heap.push(node(a.first + b.first, next++));
+                    }
+                    int longest = 0;
+                    for (int s = 0; s < n; s++) {
+                        int depth = 0;
+                        if (f[s] != 0) {
+                            for (int p = parent[s]; p != -1; p = parent[p]) {
+                                depth++;
+                            }
+                        }
+                        lengths[s] = depth;
+                        longest = std::max(longest, depth);
+                    }
+                    if (longest <= limit) {
+                        return;
+                    }
+                    // Flatten the distribution and try again.
+                    for (int s = 0; s < n; s++) {
+                        if (f[s] != 0) {
+                            f[s] = (f[s] >> 1) | 1;
+                        }
+                    }
+                }
+            }
+
+            //! Canonical codes, bit-reversed because deflate sends them MSB first.
+            void build_codes(const uint8_t* lengths, int n, uint16_t* codes) {
+                int count[MAX_BITS + 1] = {0};
+                int next[MAX_BITS + 1] = {0};
+                for (int s = 0; s < n; s++) {
+                    count[lengths[s]]++;
+                }
+                count[0] = 0;
+                for (int b = 1, code = 0; b <= MAX_BITS; b++) {
+                    code = (code + count[b - 1]) << 1;
+                    next[b] = code;
+                }
+                for (int s = 0; s < n; s++) {
+                    int len = lengths[s];
+                    if (len == 0) {
+                        codes[s] = 0;
+                        continue;
+                    }
+                    int code = next[len]++, reversed = 0;
+                    for (int b = 0; b < len; b++) {
+                        reversed = (reversed << 1) | ((code >> b) & 1);
+                    }
+                    codes[s] = reversed;
+                }
+            }
+
+            //! Writes one block, choosing whichever of stored, fixed and dynamic
+            //! Huffman coding is smallest.
+            void write_block(bit_writer& out, const std::vector<symbol>& syms,
+                             const uint8_t* raw, size_t raw_size, bool final) {
+                const tables& t = table();
+                uint32_t lit_freq[286] = {0};
+                uint32_t dist_freq[30] = {0};
+                uint64_t extra_bits = 0;
+                for (const symbol& s : syms) {
+                    if (s.length == 0) {
+                        lit_freq[s.value]++;
+                    } else {
+                        int lc = t.len_code[s.length], dc = t.dist_of(s.value);
+                        lit_freq[257 + lc]++;
+                        dist_freq[dc]++;
+                        extra_bits += LEN_EXTRA[lc] + DIST_EXTRA[dc];
+                    }
+                }
+                lit_freq[256] = 1;
+
+                uint8_t lit_len[286], dist_len[30];
+                build_lengths(lit_freq, 286, MAX_BITS, lit_len);
+                build_lengths(dist_freq, 30, MAX_BITS, dist_len);
+                int hlit = 286, hdist = 30;
+                while (hlit > 257 && lit_len[hlit - 1] == 0) {
+                    hlit--;
+                }
+                while (hdist > 1 && dist_len[hdist - 1] == 0) {
+                    hdist--;
+                }
+
+                // Run-length encode the code lengths with symbols 16, 17 and 18.
+                uint8_t all[286 + 30];
+                std::copy(lit_len, lit_len + hlit, all);
+                std::copy(dist_len, dist_len + hdist, all + hlit);
+                int total = hlit + hdist;
+                std::vector<std::pair<uint8_t, uint8_t> > cl_syms;
+                uint32_t cl_freq[19] = {0};
+                for (int i = 0; i < total; ) {
+                    int run = 1;
+                    while (i + run < total && all[i + run] == all[i]) {
+                        run++;
+                    }
+                    int left = run;
+                    if (all[i] == 0) {
+                        while (left >= 11) {
+                            int r = std::min(left, 138);
+                            cl_syms.push_back(std::make_pair(18, r - 11));
+                            left -= r;
+                        }
+                        if (left >= 3) {
+                            cl_syms.push_back(std::make_pair(17, left - 3));
+                            left = 0;
+                        }
+                    } else {
+                        cl_syms.push_back(std::make_pair(all[i], 0));
+                        left--;
+                        while (left >= 3) {
+                            int r = std::min(left, 6);
+                            cl_syms.push_back(std::make_pair(16, r - 3));
+                            left -= r;
+                        }
+                    }
+                    for ( ; left > 0; left--) {
+                        cl_syms.push_back(std::make_pair(all[i], 0));
+                    }
+                    i += run;
+                }
+                for (size_t i = 0; i < cl_syms.size(); i++) {
+                    cl_freq[cl_syms[i].first]++;
+                }
+                uint8_t cl_len[19];
+                build_lengths(cl_freq, 19, MAX_CL_BITS, cl_len);
+                int hclen = 19;
+                while (hclen > 4 && cl_len[CL_ORDER[hclen - 1]] == 0) {
+                    hclen--;
+                }
+
+                uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * hclen + extra_bits;
+                uint64_t fixed_bits = 3 + extra_bits;
+                for (int s = 0; s < 19; s++) {
+                    int extra = s == 16 ? 2 : s == 17 ? 3 : s == 18 ? 7 : 0;
+                    dynamic_bits += (uint64_t) cl_freq[s] * (cl_len[s] + extra);
+                }
+                for (int s = 0; s < 286; s++) {
+                    dynamic_bits += (uint64_t) lit_freq[s] * lit_len[s];
+                    fixed_bits += (uint64_t) lit_freq[s] * t.fixed_lit[s];
+                }
+                for (int s = 0; s < 30; s++) {
+                    dynamic_bits += (uint64_t) dist_freq[s] * dist_len[s];
+                    fixed_bits += (uint64_t) dist_freq[s] * t.fixed_dist[s];
+                }
+                uint64_t stored_bits = ((raw_size + MAX_STORED - 1) / MAX_STORED) * 5 * 8 + raw_size * 8 + 7;
+
+                if (raw_size > 0 && stored_bits < std::min(dynamic_bits, fixed_bits)) {
+                    for (size_t pos = 0; pos < raw_size; pos += MAX_STORED) {
+                        size_t n = std::min(MAX_STORED, raw_size - pos);
+                        out.stored(raw + pos, n, final && pos + n == raw_size);
+                    }
+                    return;
+                }
+
+                uint16_t lit_code[288], dist_code[30];
+                const uint8_t* lit_bits = lit_len;
+                const uint8_t* dist_bits = dist_len;
+                if (fixed_bits <= dynamic_bits) {
+                    out.put(final ? 1 : 0, 1);
+                    out.put(1, 2);
+                    lit_bits = t.fixed_lit;
+                    dist_bits = t.fixed_dist;
+                    build_codes(lit_bits, 288, lit_code);
+                    build_codes(dist_bits, 30, dist_code);
+                } else {
+                    out.put(final ? 1 : 0, 1);
+                    out.put(2, 2);
+                    out.put(hlit - 257, 5);
+                    out.put(hdist - 1, 5);
+                    out.put(hclen - 4, 4);
+                    for (int i = 0; i < hclen; i++) {
+                        out.put(cl_len[CL_ORDER[i]], 3);
+                    }
+                    uint16_t cl_code[19];
+                    build_codes(cl_len, 19, cl_code);
+                    for (size_t i = 0; i < cl_syms.size(); i++) {
+                        int s = cl_syms[i].first;
+                        out.put(cl_code[s], cl_len[s]);
+                        if (s >= 16) {
+                            out.put(cl_syms[i].second, s == 16 ? 2 : s == 17 ? 3 : 7);
+                        }
+                    }
+                    build_codes(lit_bits, 286, lit_code);
+                    build_codes(dist_bits, 30, dist_code);
+                }
+
+                for (const symbol& s : syms) {
+                    if (s.length == 0) {
+                        out.put(lit_code[s.value], lit_bits[s.value]);
+                        continue;
+                    }
+                    int lc = t.len_code[s.length], dc = t.dist_of(s.value);
+                    out.put(lit_code[257 + lc], lit_bits[257 + lc]);
+                    out.put(s.length - LEN_BASE[lc], LEN_EXTRA[lc]);
+                    out.put(dist_code[dc], dist_bits[dc]);
+                    out.put(s.value - DIST_BASE[dc], DIST_EXTRA[dc]);
+                }
+                out.put(lit_code[256], lit_bits[256]);
+            }
+
+            //! LZ77 match finder over a sliding window, with hash chains.
+            class matcher {
+            public:
+                matcher(const uint8_t* data, size_t size, const level_config& config) :
+                        data(data), size(size), config(config),
+                        head((size_t) 1 << HASH_BITS, -1), prev(WINDOW, -1) {}
+
+                void insert(size_t pos) {
+                    if (size - pos < (size_t) MIN_MATCH) {
+                        return;
+                    }
+                    uint32_t h = hash(pos);
+                    prev[pos & (WINDOW - 1)] = head[h];
+                    head[h] = (int64_t) pos;
+                }
+
+                //! Longest match at pos among earlier positions; length 0 if none.
+                int find(size_t pos, int& dist) const {
+                    if (size - pos < (size_t) MIN_MATCH) {
+                        return 0;
+                    }
+                    int limit = (int) std::min<size_t>(MAX_MATCH, size - pos);
+                    int best = 0, chain = config.chain;
+                    const uint8_t* p = data + pos;
+                    for (int64_t cand = head[hash(pos)]; cand >= 0 && chain-- > 0; ) {
+                        size_t d = pos - (size_t) cand;
+                        if (d > WINDOW) {
+                            break;
+                        }
+                        const uint8_t* q = data + cand;
+                        if (q[best] == p[best] && q[0] == p[0] && q[1] == p[1]) {
+                            int len = 2;
+                            while (len < limit && q[len] == p[len]) {
+                                len++;
+                            }
+                            if (len > best) {
+                                best = len;
+                                dist = (int) d;
+                                if (len >= config.nice || len == limit) {
+                                    break;
+                                }
+                            }
+                        }
+                        int64_t next = prev[cand & (WINDOW - 1)];
+                        if (next >= cand) {
+                            break;
+                        }
+                        cand = next;
+                    }
+                    return best >= MIN_MATCH ? best : 0;
+                }
+
+            private:
+                uint32_t hash(size_t pos) const {
+                    uint32_t v = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+                    return (v * 2654435761u) >> (32 - HASH_BITS);
+                }
+
+                const uint8_t* data;
+                size_t size;
+                const level_config& config;
+                std::vector<int64_t> head;
+                std::vector<int64_t> prev;
+            };
+        }
+
+        void compress(const uint8_t* data, size_t size, int level, bool last, std::vector<uint8_t>& out, size_t dict) {
+            level = std::max(0, std::min(9, level));
+            bit_writer bits(out);
+            if (level == 0) {
+                for (size_t pos = 0; pos < size; pos += MAX_STORED) {
+                    size_t n = std::min(MAX_STORED, size - pos);
+                    bits.stored(data + pos, n, last && pos + n == size);
+                }
+                if (size == 0 && last) {
+                    bits.stored(data, 0, true);
+                }
+            } else {
+                const level_config& config = LEVELS[level];
+                // Work on one buffer that starts with the dictionary: matches may
+                // reach back into it, but only the bytes after it are encoded.
+                dict = std::min(dict, WINDOW);
+                const uint8_t* w = data - dict;
+                size_t end = dict + size;
+                matcher m(w, end, config);
+                for (size_t p = 0; p < dict; p++) {
+                    m.insert(p);
+                }
+                std::vector<symbol> syms;
+                syms.reserve(BLOCK_SYMBOLS + 2);
+                size_t block_start = dict, i = dict;
+                int len = 0, dist = 0;
+                bool known = false, final_written = false;
+                while (i < end) {
+                    if (!known) {
+                        len = m.find(i, dist);
+                        m.insert(i);
+                    }
+                    known = false;
+                    if (len == 0) {
+                        symbol s = {0, w[i]};
+                        syms.push_back(s);
+                        i++;
+                    } else {
+                        if (config.lazy && len < config.nice && i + 1 < end) {
+                            int dist2 = 0;
+                            int len2 = m.find(i + 1, dist2);
+                            m.insert(i + 1);
+                            if (len2 > len) {
+                                // A longer match starts at the next byte: emit this one as a literal.
+                                symbol s = {0, w[i]};
+                                syms.push_back(s);
+                                i++;
+                                len = len2;
+                                dist = dist2;
+                                known = true;
+                                continue;
+                            }
+                        } else {
+                            if (level > 3 || len <= config.nice) {
+                                m.insert(i + 1);
+                            }
+                        }
+                        symbol s = {(uint16_t) len, (uint16_t) dist};
+                        syms.push_back(s);
+                        // Fast levels skip indexing the inside of long matches.
+                        if (level > 3 || len <= config.nice) {
+                            for (size_t k = i + 2; k < i + len; k++) {
+                                m.insert(k);
+                            }
+                        }
+                        i += len;
+                    }
+                    if (syms.size() >= BLOCK_SYMBOLS && !known) {
+                        final_written = last && i == end;
+                        write_block(bits, syms, w + block_start, i - block_start, final_written);
+                        syms.clear();
+                        block_start = i;
+                    }
+                }
+                if (!syms.empty() || (last && !final_written)) {
+                    write_block(bits, syms, w + block_start, end - block_start, last);
+                }
+            }
+            if (!last) {
+                // Sync flush: an empty stored block leaves the stream byte aligned.
+                bits.stored(data, 0, false);
+            }
+            bits.align();
+        }
+
+        uint32_t adler32(const uint8_t* data, size_t size, uint32_t adler) {
+            const uint32_t MOD = 65521;
+            // 5552 bytes is the longest run whose sums cannot overflow 32 bits.
+            const size_t NMAX = 5552;
+            uint32_t a = adler & 0xFFFF, b = adler >> 16;
+            while (size > 0) {
+                size_t n = std::min(size, NMAX);
+                size -= n;
+                for (size_t i = 0; i < n; i++) {
+                    a += data[i];
+                    b += a;
+                }
+                data += n;
+                a %= MOD;
+                b %= MOD;
+            }
+            return (b << 16) | a;
+        }
+
+        uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size) {
+            // Each byte of the second part adds the first part's sum once more to b.
+            const uint32_t MOD = 65521;
+            uint32_t rem = (uint32_t) (second_size % MOD);
+            uint32_t a1 = first & 0xFFFF, b1 = first >> 16;
+            uint32_t a2 = second & 0xFFFF, b2 = second >> 16;
+            uint32_t a = (a1 + a2 + MOD - 1) % MOD;
+            uint32_t b = (uint32_t) (((uint64_t) rem * a1 + b1 + b2 + MOD - rem) % MOD);
+            return (b << 16) | a;
+        }
+
+        uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc) {
+            const uint32_t* t = table().crc;
+            crc = ~crc;
+            for (size_t i = 0; i < size; i++) {
+                crc = t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+    }
+}
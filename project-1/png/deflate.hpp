@@ -0,0 +1,37 @@
+#ifndef __png_deflate_hpp__
+#define __png_deflate_hpp__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace png {
+    //! Raw deflate (RFC 1951) and the checksums used by PNG files.
+    namespace deflate {
+        //! Compress data as raw deflate blocks, appending them to out.
+        //! @param data Bytes to compress.
+        //! @param size Number of bytes.
+        //! @param level 0 stores the data, 1 is the fastest and 9 the smallest.
+        //! @param last If true the stream ends here; otherwise it ends with a sync
+        //! flush (an empty stored block) so that more blocks can follow.
+        //! @param out Buffer the compressed bytes are appended to.
+        //! @param dict Number of bytes just before data that matches may refer to,
+        //! e.g. the end of the previous segment when a stream is compressed in
+        //! independent pieces (at most 32 KiB are used).
+        void compress(const uint8_t* data, size_t size, int level, bool last, std::vector<uint8_t>& out,
+                      size_t dict = 0);
+
+        //! Update an Adler-32 checksum (start with 1).
+        uint32_t adler32(const uint8_t* data, size_t size, uint32_t adler = 1);
+
+        //! Adler-32 of two consecutive pieces of data from the checksum of each.
+        //! @param first Checksum of the first piece.
+        //! @param second Checksum of the second piece.
+        //! @param second_size Length of the second piece.
+        uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size);
+
+        //! Update a CRC-32 checksum (start with 0).
+        uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+    }
+}
+#endif
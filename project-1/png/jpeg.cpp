@@ -0,0 +1,497 @@
+#include <png/jpeg.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace rgb;
+
+namespace png {
+    namespace jpeg {
+        namespace {
+            const uint8_t ZIGZAG[64] = {
+                0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+                12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+                35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+            };
+            const int LOOKAHEAD = 9;
+            // Largest DC difference and AC coefficient sizes in an 8-bit baseline file.
+            const int MAX_DC_SIZE = 11;
+            const int MAX_AC_SIZE = 10;
+            // DC coefficients of 8-bit samples stay within 11 bits.
+            const int MAX_DC = 2047;
+
+            struct huffman {
+                bool defined;
+                uint8_t values[256];
+                int maxcode[18];
+                int valptr[17];
+                int mincode[17];
+                // Codes of up to LOOKAHEAD bits: length (0 if longer) and value.
+                uint8_t fast_len[1 << LOOKAHEAD];
+                uint8_t fast_value[1 << LOOKAHEAD];
+                // AC codes whose extra bits also fit in the lookahead, fully decoded:
+                // value << 8 | run << 4 | bits used (0 if not available).
+                int16_t fast_ac[1 << LOOKAHEAD];
+
+                huffman() : defined(false) {}
+
+                bool build(const uint8_t* counts, const uint8_t* vals, int total) {
+                    std::copy(vals, vals + total, values);
+                    memset(fast_len, 0, sizeof(fast_len));
+                    int code = 0, k = 0;
+                    for (int len = 1; len <= 16; len++) {
+                        valptr[len] = k;
+                        mincode[len] = code;
+                        for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+                            // over-subscribed table: the code does not fit in len bits
+                            if (code >= (1 << len)) {
+                                return false;
+                            }
+                            if (len <= LOOKAHEAD) {
+                                int shift = LOOKAHEAD - len;
+                                for (int j = 0; j < (1 << shift); j++) {
+                                    fast_len[(code << shift) | j] = len;
+                                    fast_value[(code << shift) | j] = values[k];
+                                }
+                            }
+                        }
+                        maxcode[len] = counts[len - 1] ? code - 1 : -1;
+                        code <<= 1;
+                    }
+                    maxcode[17] = INT32_MAX;
+                    for (int look = 0; look < (1 << LOOKAHEAD); look++) {
+                        fast_ac[look] = 0;
+                        int len = fast_len[look], run = fast_value[look] >> 4, size = fast_value[look] & 15;
+                        if (len == 0 || size == 0 || len + size > LOOKAHEAD) {
+                            continue;
+                        }
+                        int v = ((look << len) & ((1 << LOOKAHEAD) - 1)) >> (LOOKAHEAD - size);
+                        v = v < (1 << (size - 1)) ? v - (1 << size) + 1 : v;
+                        if (v >= -128 && v <= 127) {
+                            fast_ac[look] = (int16_t) (v * 256 + run * 16 + len + size);
+                        }
+                    }
+                    defined = true;
+                    return true;
+                }
+            };
+
+            //! Entropy-coded data reader: removes stuffed zero bytes and stops at markers.
+            class bit_reader {
+            public:
+                bit_reader(const uint8_t* data, size_t size, size_t pos) :
+                        data(data), size(size), pos(pos), acc(0), nbits(0), marker(false) {}
+
+                int bits(int n) {
+                    if (n == 0) {
+                        return 0;
+                    }
+                    fill();
+                    int v = (int) ((acc >> (nbits - n)) & ((1u << n) - 1));
+                    nbits -= n;
+                    return v;
+                }
+
+                //! Decodes an AC coefficient in one step when the table allows it.
+                //!
+                //! \return the fast_ac entry, or 0 if decode() must be used
+                int fast_ac(const huffman& h) {
+                    fill();
+                    int f = h.fast_ac[(acc >> (nbits - LOOKAHEAD)) & ((1 << LOOKAHEAD) - 1)];
+                    if (f != 0) {
+                        nbits -= f & 15;
+                    }
+                    return f;
+                }
+
+                int decode(const huffman& h) {
+                    fill();
+                    int look = (int) ((acc >> (nbits - LOOKAHEAD)) & ((1 << LOOKAHEAD) - 1));
+                    if (h.fast_len[look] != 0) {
+                        nbits -= h.fast_len[look];
+                        return h.fast_value[look];
+                    }
+                    for (int len = LOOKAHEAD + 1; len <= 16; len++) {
+                        int code = (int) ((acc >> (nbits - len)) & ((1u << len) - 1));
+                        if (code <= h.maxcode[len]) {
+                            nbits -= len;
+                            return h.values[(h.valptr[len] + code - h.mincode[len]) & 0xFF];
+                        }
+                    }
+                    nbits = 0; // corrupt data: keep going with zeros
+                    return 0;
+                }
+
+                //! Skips to the data after the next RSTn marker.
+                void restart() {
+                    acc = 0;
+                    nbits = 0;
+                    marker = false;
+                    while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7)) {
+                        pos++;
+                    }
+                    pos = std::min(size, pos + 2);
+                }
+
+            private:
+                void fill() {
+                    while (nbits <= 24) {
+                        uint32_t byte = 0;
+                        if (!marker && pos < size) {
+                            byte = data[pos];
+                            if (byte == 0xFF) {
+                                if (pos + 1 < size && data[pos + 1] == 0) {
+                                    pos += 2;
+                                } else {
+                                    marker = true;
+                                    byte = 0;
+                                }
+                            } else {
+                                pos++;
+                            }
+                        }
+                        acc = (acc << 8) | byte;
+                        nbits += 8;
+                    }
+                }
+
+                const uint8_t* data;
+                size_t size;
+                size_t pos;
+                uint32_t acc;
+                int nbits;
+                bool marker;
+            };
+
+            struct component {
+                int id, h, v, tq, td, ta;
+                int pred;
+                int stride;
+                std::vector<uint8_t> plane;
+            };
+
+            // Reduced inverse DCTs. They use the same normalization as the 8-point
+            // transform, c(u) / 2 * cos((2i + 1) u pi / 2n), so an n x n output
+            // block is on the scale of the original samples.
+            const float K0 = 0.353553391f; // cos(pi/4) / 2
+            const float K1 = 0.461939766f; // cos(pi/8) / 2
+            const float K3 = 0.191341716f; // cos(3pi/8) / 2
+
+            uint8_t sample(float v) {
+                int i = (int) (v + 128.5f);
+                return (uint8_t) (i < 0 ? 0 : i > 255 ? 255 : i);
+            }
+
+            //! 4-point IDCT with the usual even/odd split (8 multiplications).
+            inline void idct4(const float* in, int step, float* out, int ostep) {
+                float e0 = K0 * (in[0] + in[2 * step]), e1 = K0 * (in[0] - in[2 * step]);
+                float o0 = K1 * in[step] + K3 * in[3 * step], o1 = K3 * in[step] - K1 * in[3 * step];
+                out[0] = e0 + o0;
+                out[ostep] = e1 + o1;
+                out[2 * ostep] = e1 - o1;
+                out[3 * ostep] = e0 - o0;
+            }
+
+            //! n x n samples from the top-left n x n coefficients (row-major) of a block.
+            template <int N>
+            void idct(const float* coef, uint8_t* out, int stride);
+
+            template <>
+            void idct<1>(const float* coef, uint8_t* out, int) {
+                out[0] = sample(coef[0] * 0.125f);
+            }
+
+            template <>
+            void idct<2>(const float* c, uint8_t* out, int stride) {
+                out[0] = sample((c[0] + c[1] + c[2] + c[3]) * 0.125f);
+                out[1] = sample((c[0] - c[1] + c[2] - c[3]) * 0.125f);
+                out[stride] = sample((c[0] + c[1] - c[2] - c[3]) * 0.125f);
+                out[stride + 1] = sample((c[0] - c[1] - c[2] + c[3]) * 0.125f);
+            }
+
+            template <>
+            void idct<4>(const float* coef, uint8_t* out, int stride) {
+                float rows[16], cols[16];
+                for (int v = 0; v < 4; v++) {
+                    idct4(coef + 4 * v, 1, rows + 4 * v, 1);
+                }
+                for (int i = 0; i < 4; i++) {
+                    idct4(rows + i, 4, cols + i, 4);
+                }
+                for (int j = 0; j < 4; j++) {
+                    for (int i = 0; i < 4; i++) {
+                        out[j * stride + i] = sample(cols[4 * j + i]);
+                    }
+                }
+            }
+
+            int extend(int v, int t) {
+                return v < (1 << (t - 1)) ? v - (1 << t) + 1 : v;
+            }
+
+            uint16_t get16(const uint8_t* p) {
+                return (uint16_t) (p[0] << 8 | p[1]);
+            }
+
+            uint8_t clamp(int v) {
+                return (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+            }
+        }
+
+        image* load_scaled(const std::string& file, int scale) {
+            if (scale != 2 && scale != 4 && scale != 8) {
+                return NULL;
+            }
+            const int n = 8 / scale;
+            std::ifstream in(file.c_str(), std::ios::binary);
+            std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+                return NULL;
+            }
+
+            uint16_t quant[4][64];
+            bool quant_defined[4] = {false, false, false, false};
+            huffman dc[4], ac[4];
+            std::vector<component> comps;
+            int width = 0, height = 0, restart_interval = 0;
+            size_t pos = 2;
+            for (;;) {
+                // next marker
+                while (pos < data.size() && data[pos] != 0xFF) {
+                    pos++;
+                }
+                while (pos < data.size() && data[pos] == 0xFF) {
+                    pos++;
+                }
+                if (pos + 2 >= data.size()) {
+                    return NULL;
+                }
+                int m = data[pos++];
+                if (m == 0xD9) {
+                    return NULL; // no scan
+                }
+                if (m == 0x01 || (m >= 0xD0 && m <= 0xD7)) {
+                    continue; // markers without a segment
+                }
+                size_t len = get16(&data[pos]);
+                if (len < 2 || pos + len > data.size()) {
+                    return NULL;
+                }
+                const uint8_t* seg = &data[pos + 2];
+                size_t seg_len = len - 2;
+                pos += len;
+                if (m == 0xDB) {
+                    for (size_t i = 0; i < seg_len; ) {
+                        int pq = seg[i] >> 4, tq = seg[i] & 3;
+                        i++;
+                        if (i + (pq ? 128 : 64) > seg_len) {
+                            return NULL;
+                        }
+                        for (int k = 0; k < 64; k++) {
+                            quant[tq][k] = pq ? get16(&seg[i + 2 * k]) : seg[i + k];
+                        }
+                        quant_defined[tq] = true;
+                        i += pq ? 128 : 64;
+                    }
+                } else if (m == 0xC4) {
+                    for (size_t i = 0; i < seg_len; ) {
+                        if (i + 17 > seg_len) {
+                            return NULL;
+                        }
+                        int tc = seg[i] >> 4, th = seg[i] & 3;
+                        int total = 0;
+                        for (int k = 0; k < 16; k++) {
+                            total += seg[i + 1 + k];
+                        }
+                        if (total > 256 || i + 17 + total > seg_len) {
+                            return NULL;
+                        }
+                        huffman& h = tc == 0 ? dc[th] : ac[th];
+                        if (!h.build(&seg[i + 1], &seg[i + 17], total)) {
+                            return NULL;
+                        }
+                        i += 17 + total;
+                    }
+                } else if (m == 0xDD) {
+                    if (seg_len < 2) {
+                        return NULL;
+                    }
+                    restart_interval = get16(seg);
+                } else if (m == 0xC0 || m == 0xC1) {
+                    if (seg_len < 6 || seg[0] != 8) {
+                        return NULL;
+                    }
+                    height = get16(&seg[1]);
+                    width = get16(&seg[3]);
+                    int count = seg[5];
+                    if ((count != 1 && count != 3) || seg_len < 6 + 3 * (size_t) count || width == 0 || height == 0) {
+                        return NULL; // CMYK, or height defined by a DNL marker
+                    }
+                    for (int c = 0; c < count; c++) {
+                        component comp = component();
+                        comp.id = seg[6 + 3 * c];
+                        comp.h = count == 1 ? 1 : seg[7 + 3 * c] >> 4;
+                        comp.v = count == 1 ? 1 : seg[7 + 3 * c] & 15;
+                        comp.tq = seg[8 + 3 * c] & 3;
+                        if (comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4) {
+                            return NULL;
+                        }
+                        comps.push_back(comp);
+                    }
+                } else if ((m >= 0xC2 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC)) {
+                    return NULL; // progressive, lossless or arithmetic coding
+                } else if (m == 0xDA) {
+                    if (comps.empty() || seg_len < 1 || seg[0] != (int) comps.size() || seg_len < 1 + 2 * comps.size()) {
+                        return NULL; // non-interleaved scans are not supported
+                    }
+                    for (size_t c = 0; c < comps.size(); c++) {
+                        int id = seg[1 + 2 * c];
+                        component* comp = NULL;
+                        for (component& k : comps) {
+                            if (k.id == id) {
+                                comp = &k;
+                            }
+                        }
+                        if (comp == NULL) {
+                            return NULL;
+                        }
+                        comp->td = seg[2 + 2 * c] >> 4 & 3;
+                        comp->ta = seg[2 + 2 * c] & 3;
+                        if (!dc[comp->td].defined || !ac[comp->ta].defined || !quant_defined[comp->tq]) {
+                            return NULL;
+                        }
+                    }
+                    break;
+                }
+            }
+
+            int hmax = 1, vmax = 1;
+            for (const component& c : comps) {
+                hmax = std::max(hmax, c.h);
+                vmax = std::max(vmax, c.v);
+            }
+            for (const component& c : comps) {
+                if (hmax % c.h != 0 || vmax % c.v != 0) {
+                    return NULL;
+                }
+            }
+            int mcux = (width + 8 * hmax - 1) / (8 * hmax);
+            int mcuy = (height + 8 * vmax - 1) / (8 * vmax);
+            for (component& c : comps) {
+                c.pred = 0;
+                c.stride = mcux * c.h * n;
+                c.plane.assign((size_t) c.stride * mcuy * c.v * n, 0);
+            }
+
+            // Every coefficient still has to be entropy decoded, but only the
+            // n x n low-frequency ones are dequantized and transformed.
+            void (*idct_n)(const float*, uint8_t*, int) = n == 4 ? idct<4> : n == 2 ? idct<2> : idct<1>;
+            bit_reader bits(data.data(), data.size(), pos);
+            float coef[16];
+            int mcus = 0;
+            for (int my = 0; my < mcuy; my++) {
+                for (int mx = 0; mx < mcux; mx++) {
+                    if (restart_interval != 0 && mcus != 0 && mcus % restart_interval == 0) {
+                        bits.restart();
+                        for (component& c : comps) {
+                            c.pred = 0;
+                        }
+                    }
+                    mcus++;
+                    for (component& c : comps) {
+                        const uint16_t* q = quant[c.tq];
+                        const huffman& h = ac[c.ta];
+                        for (int by = 0; by < c.v; by++) {
+                            for (int bx = 0; bx < c.h; bx++) {
+                                std::fill(coef, coef + n * n, 0.0f);
+                                int t = bits.decode(dc[c.td]);
+                                if (t > MAX_DC_SIZE) {
+                                    return NULL;
+                                }
+                                c.pred += t ? extend(bits.bits(t), t) : 0;
+                                // corrupt differences could otherwise add up past int
+                                c.pred = std::max(-MAX_DC - 1, std::min(MAX_DC, c.pred));
+                                coef[0] = (float) c.pred * q[0];
+                                for (int k = 1; k < 64; ) {
+                                    int value, f = bits.fast_ac(h);
+                                    if (f != 0) {
+                                        k += (f >> 4) & 15;
+                                        value = f >> 8;
+                                    } else {
+                                        int rs = bits.decode(h);
+                                        int r = rs >> 4, s = rs & 15;
+                                        if (s == 0) {
+                                            if (r != 15) {
+                                                break; // end of block
+                                            }
+                                            k += 16;
+                                            continue;
+                                        }
+                                        if (s > MAX_AC_SIZE) {
+                                            return NULL;
+                                        }
+                                        k += r;
+                                        value = extend(bits.bits(s), s);
+                                    }
+                                    if (k > 63) {
+                                        break;
+                                    }
+                                    int z = ZIGZAG[k];
+                                    if (z / 8 < n && z % 8 < n) {
+                                        coef[(z / 8) * n + z % 8] = (float) value * q[k];
+                                    }
+                                    k++;
+                                }
+                                int x0 = (mx * c.h + bx) * n, y0 = (my * c.v + by) * n;
+                                idct_n(coef, &c.plane[(size_t) y0 * c.stride + x0], c.stride);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // Colour conversion; subsampled chroma is replicated.
+            int ow = (width + scale - 1) / scale, oh = (height + scale - 1) / scale;
+            std::shared_ptr<color> pixels = image::allocate((size_t) ow * oh);
+            uint8_t* out = reinterpret_cast<uint8_t*>(pixels.get());
+            // plane column of each output column, per component
+            std::vector<std::vector<int>> column(comps.size(), std::vector<int>(ow));
+            for (size_t i = 0; i < comps.size(); i++) {
+                for (int x = 0; x < ow; x++) {
+                    column[i][x] = x * comps[i].h / hmax;
+                }
+            }
+            for (int y = 0; y < oh; y++) {
+                uint8_t* p = out + 3 * (size_t) y * ow;
+                const component& Y = comps[0];
+                const uint8_t* luma = &Y.plane[(size_t) (y * Y.v / vmax) * Y.stride];
+                if (comps.size() == 1) {
+                    for (int x = 0; x < ow; x++, p += 3) {
+                        p[0] = p[1] = p[2] = luma[x];
+                    }
+                    continue;
+                }
+                const component& Cb = comps[1];
+                const component& Cr = comps[2];
+                const uint8_t* cbrow = &Cb.plane[(size_t) (y * Cb.v / vmax) * Cb.stride];
+                const uint8_t* crrow = &Cr.plane[(size_t) (y * Cr.v / vmax) * Cr.stride];
+                const int* ly = column[0].data();
+                const int* lcb = column[1].data();
+                const int* lcr = column[2].data();
+                for (int x = 0; x < ow; x++, p += 3) {
+                    int cb = cbrow[lcb[x]] - 128, cr = crrow[lcr[x]] - 128;
+                    // JFIF conversion in 16.16 fixed point
+                    int l = (luma[ly[x]] << 16) + (1 << 15);
+                    p[0] = clamp((l + 91881 * cr) >> 16);
+                    p[1] = clamp((l - 22554 * cb - 46802 * cr) >> 16);
+                    p[2] = clamp((l + 116130 * cb) >> 16);
+                }
+            }
+            return new image(ow, oh, pixels);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef __png_jpeg_hpp__
+#define __png_jpeg_hpp__
+
+#include <string>
+#include <rgb/image.hpp>
+
+namespace png {
+    //! Reduced-size decoding of baseline JPEG files (full-size JPEG decoding
+    //! goes through stb in png::load).
+    namespace jpeg {
+        //! Decode a baseline JPEG at 1/2, 1/4 or 1/8 of its size.
+        //! Only the low-frequency coefficients of each 8x8 block are kept and
+        //! transformed with a 4x4, 2x2 or 1x1 inverse DCT, so most of the
+        //! transform work of a full decode is skipped.
+        //! @param file File name.
+        //! @param scale 2, 4 or 8; each dimension becomes ceil(size / scale).
+        //! @return A new image (dynamically allocated), or NULL if the file is
+        //! not a JPEG this decoder handles (e.g. progressive or CMYK).
+        rgb::image *load_scaled(const std::string &file, int scale);
+    }
+}
+#endif
@@ -1,7 +1,39 @@
 #include <png/png.hpp>
+#include <png/deflate.hpp>
+#include <png/jpeg.hpp>
+#include <png/pnm.hpp>
+#include <png/qoi.hpp>
+#include <png/stream.hpp>
 #include <rgb/image.hpp>
+#include <rgb/image_view.hpp>
+#include <rgb/parallel.hpp>
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include <rgb/memory.hpp>
+#include <rgb/trace.hpp>
+
+// stb's allocations are counted like the images' own (rgb::memory).
+static void* stb_counted_malloc(size_t size) {
+    rgb::memory::count(size);
+    return malloc(size);
+}
+
+static void* stb_counted_realloc(void* p, size_t old_size, size_t new_size) {
+    rgb::memory::count(new_size > old_size ? new_size - old_size : 0);
+    return realloc(p, new_size);
+}
+
+#define STBI_MALLOC(size) stb_counted_malloc(size)
+#define STBI_REALLOC_SIZED(p, old_size, new_size) stb_counted_realloc(p, old_size, new_size)
+#define STBI_FREE(p) free(p)
 #define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -9,51 +41,470 @@
 
 using namespace rgb;
 
+// The image buffer is handed to stb as-is, so a color must be exactly
+// three interleaved rgb_value bytes.
+static_assert(sizeof(color) == 3, "rgb::color must be packed RGB");
+
 namespace png {
+    namespace {
+        enum file_format { PNG, QOI, PPM, PAM, JPEG };
+
+        // The format is chosen by the file extension; anything unknown is PNG.
+        file_format format_of(const std::string& file) {
+            size_t dot = file.find_last_of("./");
+            std::string ext;
+            if (dot != std::string::npos && file[dot] == '.') {
+                for (size_t i = dot + 1; i < file.size(); i++) {
+                    ext.push_back((char) std::tolower((unsigned char) file[i]));
+                }
+            }
+            if (ext == "qoi") {
+                return QOI;
+            }
+            if (ext == "ppm" || ext == "pnm") {
+                return PPM;
+            }
+            if (ext == "pam") {
+                return PAM;
+            }
+            if (ext == "jpg" || ext == "jpeg") {
+                return JPEG;
+            }
+            return PNG;
+        }
+
+        // Averages each scale x scale block of pixels (partial at the edges).
+        image* shrink(const image& img, int scale) {
+            int w = (img.width() + scale - 1) / scale, h = (img.height() + scale - 1) / scale;
+            std::shared_ptr<color> pixels = image::allocate((size_t) w * h);
+            rgb_value* out = reinterpret_cast<rgb_value*>(pixels.get());
+            image_view view = img.view();
+            for (int y = 0; y < h; y++) {
+                int y1 = std::min(view.height(), (y + 1) * scale);
+                for (int x = 0; x < w; x++) {
+                    int x1 = std::min(view.width(), (x + 1) * scale);
+                    int sum[3] = {0, 0, 0}, count = (x1 - x * scale) * (y1 - y * scale);
+                    for (int yy = y * scale; yy < y1; yy++) {
+                        const rgb_value* p = reinterpret_cast<const rgb_value*>(view.row(yy));
+                        for (int xx = x * scale; xx < x1; xx++) {
+                            sum[0] += p[3 * xx];
+                            sum[1] += p[3 * xx + 1];
+                            sum[2] += p[3 * xx + 2];
+                        }
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        out[3 * ((size_t) y * w + x) + c] = (rgb_value) ((sum[c] + count / 2) / count);
+                    }
+                }
+            }
+            return new image(w, h, pixels);
+        }
+
+        // Writes the formats other than PNG; returns false for PNG files.
+        bool save_other(const std::string& file, const image_view& view) {
+            switch (format_of(file)) {
+                case QOI: qoi::save(file, view); return true;
+                case PPM: pnm::save_ppm(file, view); return true;
+                case PAM: pnm::save_pam(file, view); return true;
+                default: return false;
+            }
+        }
+    }
+
     image* load(const std::string& file) {
+        rgb::trace::span t("png", "png::load", file);
+        switch (format_of(file)) {
+            case QOI: return qoi::load(file);
+            case PPM:
+            case PAM: return pnm::load(file);
+            default: break;
+        }
         int w, h, dummy;
         rgb_value *buffer = stbi_load(file.c_str(), &w, &h, &dummy, 3);
         if (buffer == NULL) {
             return NULL; // Could not load image!
         }
-        auto p = buffer;
-        auto img = new image(w, h);
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w; x++) {
-                rgb_value red = p[0];
-                rgb_value green = p[1];
-                rgb_value blue = p[2];
-                img -> at(x, y) = color(red, green, blue);
-                p += 3;
+        // The image adopts stb's buffer (row-major interleaved RGB, like its
+        // own storage) and frees it with stb's allocator: no fill and no copy.
+        // It is charged to the current memory account like any pixel buffer.
+        size_t bytes = (size_t) w * h * sizeof(color);
+        std::shared_ptr<rgb::memory::account> owner;
+        try {
+            owner = rgb::memory::acquire(bytes);
+        } catch (const std::bad_alloc&) {
+            stbi_image_free(buffer);
+            throw;
+        }
+        std::shared_ptr<color> pixels(reinterpret_cast<color*>(buffer), [owner, bytes](color* p) {
+            stbi_image_free(p);
+            rgb::memory::release(owner, bytes);
+        });
+        return new image(w, h, pixels);
+    }
+
+    image* load(const std::string& file, int scale) {
+        if (scale <= 1) {
+            return load(file);
+        }
+        rgb::trace::span t("png", "png::load", file);
+        if (format_of(file) == JPEG) {
+            image* img = jpeg::load_scaled(file, scale);
+            if (img != NULL) {
+                return img;
             }
         }
-        stbi_image_free(buffer);
-        return img;
+        // other formats (and JPEGs the reduced decoder does not handle)
+        std::unique_ptr<image> full(load(file));
+        return full ? shrink(*full, scale) : NULL;
     }
 
-    void save(const std::string& file, const image* image) {
-        auto w = image->width();
-        auto h = image->height();
-        auto buffer = new rgb_value[w * h * 3];
-        auto p = buffer;
-        for (auto y = 0; y < h; y++) {
-            for (auto x = 0; x < w; x++) {
-                auto c = image->at(x, y);
-                p[0] = c.red();
-                p[1] = c.green();
-                p[2] = c.blue();
-                p += 3;
+    bool load(const std::string& file, image& img) {
+        return load(file, 1, img);
+    }
+
+    bool load(const std::string& file, int scale, image& img) {
+        std::unique_ptr<image> loaded(load(file, scale));
+        if (!loaded) {
+            return false;
+        }
+        img = std::move(*loaded);
+        return true;
+    }
+
+    namespace {
+        //! Filtered bytes compressed as one deflate segment by the parallel writer.
+        const size_t SEGMENT = 128 << 10;
+        //! Bytes of the previous segment that a segment's matches may refer to.
+        const size_t DICTIONARY = 32 << 10;
+        //! Filtered bytes the writer keeps in memory at a time (whole segments).
+        const size_t BATCH = 64 * SEGMENT;
+        //! Images from this size on are not saved with stb even without options:
+        //! it keeps the whole filtered and compressed image in memory, and its
+        //! int offsets overflow a little further on.
+        const size_t STB_LIMIT = (size_t) 256 << 20;
+
+        const char* const FILTER_NAMES[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+
+        bool has_defaults = false;
+        options defaults;
+
+        int paeth(int a, int b, int c) {
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        }
+
+        // Writes filter type f of row (with the previous row prior, NULL for the
+        // first one) into out, which has room for the type byte and the row.
+        void filter_row(int f, const uint8_t* row, const uint8_t* prior, size_t bytes, uint8_t* out) {
+            const int bpp = 3;
+            out[0] = (uint8_t) f;
+            out++;
+            for (size_t i = 0; i < bytes; i++) {
+                int a = i >= (size_t) bpp ? row[i - bpp] : 0;
+                int b = prior != NULL ? prior[i] : 0;
+                int c = prior != NULL && i >= (size_t) bpp ? prior[i - bpp] : 0;
+                int pred = 0;
+                switch (f) {
+                    case FILTER_SUB: pred = a; break;
+                    case FILTER_UP: pred = b; break;
+                    case FILTER_AVERAGE: pred = (a + b) >> 1; break;
+                    case FILTER_PAETH: pred = paeth(a, b, c); break;
+                    default: break;
+                }
+                out[i] = (uint8_t) (row[i] - pred);
+            }
+        }
+
+        // Sum of the filtered bytes taken as signed values, the usual estimate
+        // of how well a row will compress.
+        unsigned long cost(const uint8_t* filtered, size_t bytes) {
+            unsigned long sum = 0;
+            for (size_t i = 0; i < bytes; i++) {
+                sum += std::abs((int) (int8_t) filtered[i]);
+            }
+            return sum;
+        }
+
+        // Filters the rows of the view into out, one line (type byte and row)
+        // after the other; prior is the row above the first one (NULL at the
+        // top of the image). Each row only reads the original pixels, so bands
+        // of rows are independent.
+        void filter_rows(const image_view& view, const uint8_t* prior, const options& opts, uint8_t* out) {
+            size_t bytes = (size_t) view.width() * 3;
+            size_t row_cost = opts.filter == FILTER_ADAPTIVE ? bytes * 5 : bytes;
+            rgb::parallel::for_rows(view.height(), row_cost, [&](int y0, int y1) {
+                std::vector<uint8_t> trial(opts.filter == FILTER_ADAPTIVE ? bytes + 1 : 0);
+                for (int y = y0; y < y1; y++) {
+                    const uint8_t* row = reinterpret_cast<const uint8_t*>(view.row(y));
+                    const uint8_t* above = y == 0 ? prior : reinterpret_cast<const uint8_t*>(view.row(y - 1));
+                    uint8_t* line = out + (bytes + 1) * y;
+                    if (opts.filter != FILTER_ADAPTIVE) {
+                        filter_row(opts.filter, row, above, bytes, line);
+                        continue;
+                    }
+                    unsigned long best = 0;
+                    for (int f = FILTER_NONE; f <= FILTER_PAETH; f++) {
+                        filter_row(f, row, above, bytes, trial.data());
+                        unsigned long c = cost(trial.data() + 1, bytes);
+                        if (f == FILTER_NONE || c < best) {
+                            best = c;
+                            std::copy(trial.begin(), trial.end(), line);
+                        }
+                    }
+                }
+            });
+        }
+
+        void put32(std::vector<uint8_t>& out, uint32_t v) {
+            out.push_back(v >> 24);
+            out.push_back(v >> 16);
+            out.push_back(v >> 8);
+            out.push_back(v);
+        }
+
+        void chunk(std::ofstream& out, const char* type, const uint8_t* data, size_t size) {
+            std::vector<uint8_t> head;
+            put32(head, (uint32_t) size);
+            head.insert(head.end(), type, type + 4);
+            uint32_t crc = deflate::crc32(head.data() + 4, 4);
+            crc = deflate::crc32(data, size, crc);
+            std::vector<uint8_t> tail;
+            put32(tail, crc);
+            out.write(reinterpret_cast<const char*>(head.data()), head.size());
+            out.write(reinterpret_cast<const char*>(data), size);
+            out.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+        }
+
+        // The built-in encoder. The filtered rows form one zlib stream; like
+        // pigz, it is compressed in fixed-size segments in parallel: each one
+        // ends with a sync flush (the last one with a final block) and is
+        // primed with the end of the previous segment, so joining them gives a
+        // single valid deflate stream. The segment size does not depend on the
+        // number of threads, so neither does the output. Rows are filtered as
+        // they arrive and compressed BATCH bytes at a time, each batch becoming
+        // an IDAT chunk, so only about BATCH filtered bytes are kept in memory.
+        class png_writer : public writer {
+        public:
+            explicit png_writer(const options& opts) :
+                    opts(opts), line(0), total(0), done(0), base(0), adler(1) {}
+
+            bool open(const std::string& file, int width, int height) {
+                line = (size_t) width * 3 + 1;
+                total = line * height;
+                out.open(file.c_str(), std::ios::binary);
+                std::vector<uint8_t> ihdr;
+                put32(ihdr, width);
+                put32(ihdr, height);
+                const uint8_t rest[5] = {8, 2, 0, 0, 0}; // 8-bit RGB, no interlacing
+                ihdr.insert(ihdr.end(), rest, rest + 5);
+                const uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+                out.write(reinterpret_cast<const char*>(signature), 8);
+                chunk(out, "IHDR", ihdr.data(), ihdr.size());
+                return (bool) out;
+            }
+
+            bool write(const image_view& rows) {
+                size_t start = pending.size();
+                pending.resize(start + line * rows.height());
+                filter_rows(rows, last.empty() ? NULL : last.data(), opts, &pending[start]);
+                const uint8_t* bottom = reinterpret_cast<const uint8_t*>(rows.row(rows.height() - 1));
+                last.assign(bottom, bottom + line - 1);
+                while (pending.size() - base >= BATCH) {
+                    compress(BATCH);
+                }
+                // keep only the dictionary of what was compressed
+                size_t keep = std::min(done, DICTIONARY);
+                pending.erase(pending.begin(), pending.begin() + (base - keep));
+                base = keep;
+                return (bool) out;
+            }
+
+            bool close() {
+                if (done + (pending.size() - base) != total) {
+                    return false; // not all the rows were written
+                }
+                compress(pending.size() - base);
+                chunk(out, "IEND", NULL, 0);
+                return (bool) out.flush();
+            }
+
+        private:
+            // Compresses the next size filtered bytes (pending[base, base + size))
+            // into an IDAT chunk.
+            void compress(size_t size) {
+                size_t count = std::max<size_t>(1, (size + SEGMENT - 1) / SEGMENT);
+                std::vector<std::vector<uint8_t> > packed(count);
+                std::vector<uint32_t> sums(count);
+                rgb::parallel::for_rows((int) count, SEGMENT, [&](int i0, int i1) {
+                    for (int i = i0; i < i1; i++) {
+                        size_t begin = done + i * SEGMENT, length = std::min(SEGMENT, total - begin);
+                        const uint8_t* data = pending.data() + base + i * SEGMENT;
+                        deflate::compress(data, length, opts.level, begin + length == total, packed[i],
+                                          std::min(begin, DICTIONARY));
+                        sums[i] = deflate::adler32(data, length);
+                    }
+                });
+
+                std::vector<uint8_t> idat;
+                if (done == 0) {
+                    const uint8_t flags[4] = {0x01, 0x5E, 0x9C, 0xDA};
+                    idat.push_back(0x78);
+                    idat.push_back(flags[opts.level < 2 ? 0 : opts.level < 6 ? 1 : opts.level == 6 ? 2 : 3]);
+                }
+                for (size_t i = 0; i < count; i++) {
+                    idat.insert(idat.end(), packed[i].begin(), packed[i].end());
+                    adler = deflate::adler32_combine(adler, sums[i], std::min(SEGMENT, total - done - i * SEGMENT));
+                }
+                done += size;
+                base += size;
+                if (done == total) {
+                    put32(idat, adler); // zlib trailer: Adler-32 of the filtered rows
+                }
+                chunk(out, "IDAT", idat.data(), idat.size());
+            }
+
+            options opts;
+            std::ofstream out;
+            // filtered bytes per row (with the filter type byte) and in the image
+            size_t line, total;
+            // filtered bytes already compressed
+            size_t done;
+            // pending[base] is the first filtered byte not compressed yet; the
+            // bytes before it are the dictionary of the next segment
+            size_t base;
+            std::vector<uint8_t> pending;
+            // the last row written, the prior of the next one
+            std::vector<uint8_t> last;
+            uint32_t adler;
+        };
+    }
+
+    options::options() : level(6), filter(FILTER_ADAPTIVE) {}
+
+    options::options(int level, filter_type filter) : level(level), filter(filter) {}
+
+    options options::fast() {
+        return options(1, FILTER_UP);
+    }
+
+    options options::store() {
+        return options(0, FILTER_NONE);
+    }
+
+    options options::best() {
+        return options(9, FILTER_ADAPTIVE);
+    }
+
+    bool options::parse(const std::string& text, options& result) {
+        std::istringstream in(text);
+        options parsed = result;
+        std::string word;
+        while (in >> word) {
+            if (word == "fast") {
+                parsed = fast();
+            } else if (word == "store") {
+                parsed = store();
+            } else if (word == "best") {
+                parsed = best();
+            } else if (word == "level") {
+                if (!(in >> parsed.level) || parsed.level < 0 || parsed.level > 9) {
+                    return false;
+                }
+            } else if (word == "filter") {
+                std::string name;
+                in >> name;
+                const char* const* end = FILTER_NAMES + 6;
+                const char* const* found = std::find(FILTER_NAMES, end, name);
+                if (found == end) {
+                    return false;
+                }
+                parsed.filter = (filter_type) (found - FILTER_NAMES);
+            } else {
+                return false;
             }
         }
+        result = parsed;
+        return true;
+    }
+
+    std::string options::describe() const {
+        std::ostringstream out;
+        out << "level " << level << " filter " << FILTER_NAMES[filter];
+        return out.str();
+    }
+
+    void set_default_options(const options& opts) {
+        defaults = opts;
+        has_defaults = true;
+    }
+
+    void save(const std::string& file, const image* image) {
+        save(file, image->view());
+    }
+
+    void save(const std::string& file, const image_view& view) {
+        if (has_defaults) {
+            save(file, view, defaults);
+            return;
+        }
+        if ((size_t) view.width() * view.height() * 3 >= STB_LIMIT) {
+            save(file, view, options());
+            return;
+        }
+        rgb::trace::span t("png", "png::save", file);
+        if (save_other(file, view)) {
+            return;
+        }
+        // stb takes the distance between rows, so strided views need no copy.
         stbi_write_png(file.c_str(),
-                       w,
-                       h,
+                       view.width(),
+                       view.height(),
                        3,
-                       buffer,
-                       w * 3);
-        delete [] buffer;
+                       view.row(0),
+                       (int) view.stride() * 3);
     }
-}
 
+    void save(const std::string& file, const image* image, const options& opts) {
+        save(file, image->view(), opts);
+    }
 
+    void save(const std::string& file, const image_view& view, const options& opts) {
+        rgb::trace::span t("png", "png::save", file);
+        if (save_other(file, view)) {
+            return;
+        }
+        png_writer w(opts);
+        w.open(file, view.width(), view.height());
+        // bands of about one batch of filtered rows
+        int band = (int) std::max<size_t>(1, BATCH / ((size_t) view.width() * 3 + 1));
+        for (int y = 0; y < view.height(); y += band) {
+            w.write(view.sub(0, y, view.width(), std::min(band, view.height() - y)));
+        }
+        w.close();
+    }
+
+    reader* open_reader(const std::string& file) {
+        switch (format_of(file)) {
+            case QOI: return qoi::open_reader(file);
+            case PPM:
+            case PAM: return pnm::open_reader(file);
+            default: return NULL;
+        }
+    }
 
+    writer* open_writer(const std::string& file, int width, int height) {
+        return open_writer(file, width, height, has_defaults ? defaults : options());
+    }
+
+    writer* open_writer(const std::string& file, int width, int height, const options& opts) {
+        switch (format_of(file)) {
+            case QOI: return qoi::open_writer(file, width, height);
+            case PPM: return pnm::open_ppm_writer(file, width, height);
+            case PAM: return pnm::open_pam_writer(file, width, height);
+            default: break;
+        }
+        std::unique_ptr<png_writer> w(new png_writer(opts));
+        return w->open(file, width, height) ? w.release() : NULL;
+    }
+}
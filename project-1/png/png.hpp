@@ -3,17 +3,104 @@
 
 #include <string>
 #include <rgb/image.hpp>
+#include <rgb/image_view.hpp>
 
 namespace png {
-    //! Load an image from a PNG file.
+    //! Row filter applied before compression.
+    enum filter_type {
+        FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH,
+        //! Choose the filter of each row that minimizes the sum of its bytes (slowest).
+        FILTER_ADAPTIVE
+    };
+
+    //! Settings of the built-in PNG encoder used by save() with options.
+    struct options {
+        //! Deflate level: 0 stores the rows uncompressed, 1 is the fastest, 9 the smallest.
+        int level;
+        //! Row filter.
+        filter_type filter;
+        //! Level 6 with adaptive filtering.
+        options();
+        //! @param level Deflate level (0 to 9).
+        //! @param filter Row filter.
+        options(int level, filter_type filter);
+        //! Fastest compression: level 1 and the up filter.
+        static options fast();
+        //! No compression at all: level 0 and no filter.
+        static options store();
+        //! Smallest output: level 9 with adaptive filtering.
+        static options best();
+        //! Parse words like "fast", "store", "best", "level 3" or "filter paeth".
+        //! Later words override earlier ones.
+        //! @param text Words separated by spaces.
+        //! @param result Parsed options; left unchanged on error.
+        //! @return false if a word is not recognized.
+        static bool parse(const std::string &text, options &result);
+        //! @return The options in the syntax accepted by parse().
+        std::string describe() const;
+    };
+
+    //! Load an image from a PNG file, or from a QOI, PPM, PAM or JPEG file when
+    //! the file name ends in .qoi, .ppm/.pnm, .pam or .jpg/.jpeg.
+    //! PNG and JPEG files are decoded by stb into malloc'd memory that the image
+    //! adopts, so they do not use rgb::image::use_scratch() and stb limits them
+    //! to about 715 megapixels; the other formats are read into image::allocate()
+    //! buffers (or, for large PPM files, mapped from the file).
     //! @param file File name.
-    //! @return A new image (dynamically allocated).
+    //! @return A new image (dynamically allocated), or NULL on error.
     rgb::image *load(const std::string &file);
 
-    //! Save an image to a PNG file.
+    //! Load an image reduced to 1/scale of its size (each dimension rounded up).
+    //! Baseline JPEGs are decoded directly at the reduced size (see
+    //! jpeg::load_scaled()); other files are decoded in full and then averaged down.
+    //! @param file File name.
+    //! @param scale 1, 2, 4 or 8.
+    //! @return A new image (dynamically allocated), or NULL on error.
+    rgb::image *load(const std::string &file, int scale);
+
+    //! Load an image into an existing rgb::image, as load(const std::string &).
+    //! The decoded buffer is moved into img: nothing is copied and no image
+    //! object is left to delete.
+    //! @param file File name.
+    //! @param img Image that receives the pixels (unchanged on error).
+    //! @return false on error.
+    bool load(const std::string &file, rgb::image &img);
+
+    //! Load an image reduced to 1/scale of its size into an existing rgb::image.
+    //! @param file File name.
+    //! @param scale 1, 2, 4 or 8.
+    //! @param img Image that receives the pixels (unchanged on error).
+    //! @return false on error.
+    bool load(const std::string &file, int scale, rgb::image &img);
+
+    //! Save an image to a PNG file (or QOI, PPM or PAM, chosen by extension as in load()).
     //! @param file File name.
-    //! //! @param img Image to save.
+    //! @param img Image to save.
     void save(const std::string &file, const rgb::image *img);
 
+    //! Save an image view to a PNG file, without copying its pixels.
+    //! @param file File name.
+    //! @param view View to save.
+    void save(const std::string &file, const rgb::image_view &view);
+
+    //! Save an image to a PNG file with the built-in encoder.
+    //! Other formats, chosen by extension, ignore the options.
+    //! @param file File name.
+    //! @param img Image to save.
+    //! @param opts Compression level and row filter.
+    void save(const std::string &file, const rgb::image *img, const options &opts);
+
+    //! Save an image view to a PNG file with the built-in encoder.
+    //! @param file File name.
+    //! @param view View to save.
+    //! @param opts Compression level and row filter.
+    void save(const std::string &file, const rgb::image_view &view, const options &opts);
+
+    //! Set the options used by the saves that do not give any.
+    //! Without a call to this function those saves use stb's encoder.
+    //! Call it before saving, e.g. when parsing the command line.
+    //! @param opts Options to use.
+    void set_default_options(const options &opts);
+
 }
 #endif
@@ -0,0 +1,300 @@
+#include <png/pnm.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <rgb/memory.hpp>
+
+using namespace rgb;
+
+namespace png {
+    namespace pnm {
+        namespace {
+            // Next header token, skipping white space and '#' comments.
+            std::string token(std::istream& in) {
+                std::string t;
+                int c;
+                while ((c = in.get()) != EOF) {
+                    if (c == '#') {
+                        while ((c = in.get()) != EOF && c != '\n') {
+                        }
+                    } else if (!std::isspace(c)) {
+                        t.push_back((char) c);
+                        break;
+                    }
+                }
+                while ((c = in.peek()) != EOF && !std::isspace(c) && c != '#') {
+                    t.push_back((char) in.get());
+                }
+                return t;
+            }
+
+            bool number(const std::string& t, long& value) {
+                if (t.empty() || t.size() > 10) {
+                    return false;
+                }
+                value = 0;
+                for (char c : t) {
+                    if (!std::isdigit((unsigned char) c)) {
+                        return false;
+                    }
+                    value = value * 10 + (c - '0');
+                }
+                return true;
+            }
+
+            // Sample data from which files are mapped rather than read: below this
+            // the page faults cost more than the copy saves.
+            const size_t MAP_THRESHOLD = 1 << 20;
+
+            // Unmaps a file mapping when the last image sharing it goes away,
+            // and returns its pixel bytes to the account that was charged for them.
+            struct unmapper {
+                size_t length;
+                std::shared_ptr<memory::account> owner;
+                size_t charged;
+                void operator()(void* p) const {
+                    munmap(p, length);
+                    memory::release(owner, charged);
+                }
+            };
+
+            // Maps bytes [offset, offset + size) of a file as a pixel buffer.
+            // The mapping is private: the pages come from the page cache and are
+            // shared with every other reader until a pixel is written, at which
+            // point the kernel copies that page; the file itself never changes.
+            // The pixel bytes are registered like an image::allocate() buffer, since
+            // they become private memory as soon as the image is written
+            // (throws std::bad_alloc if that would exceed a memory budget).
+            // Returns an empty pointer if the file cannot be mapped.
+            std::shared_ptr<color> map_samples(const std::string& file, size_t offset, size_t size) {
+                int fd = open(file.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    return std::shared_ptr<color>();
+                }
+                struct stat st;
+                void* base = MAP_FAILED;
+                if (fstat(fd, &st) == 0 && (size_t) st.st_size >= offset + size) {
+                    base = mmap(NULL, offset + size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                }
+                close(fd); // the mapping keeps the file open
+                if (base == MAP_FAILED) {
+                    return std::shared_ptr<color>();
+                }
+                std::shared_ptr<memory::account> owner;
+                try {
+                    owner = memory::acquire(size);
+                } catch (const std::bad_alloc&) {
+                    munmap(base, offset + size);
+                    throw;
+                }
+                memory::count(size);
+                std::shared_ptr<void> region(base, unmapper{offset + size, owner, size});
+                return std::shared_ptr<color>(region, reinterpret_cast<color*>(static_cast<char*>(base) + offset));
+            }
+
+            // The header is parsed when the file is opened; each band of rows is
+            // then read straight into the caller's buffer (8-bit RGB) or
+            // converted row by row.
+            class pnm_reader : public reader {
+            public:
+                pnm_reader() : depth(3), maxval(0), offset(0) {}
+
+                bool open(const std::string& file) {
+                    in.open(file.c_str(), std::ios::binary);
+                    std::string magic = token(in);
+                    long width = 0, height = 0;
+                    if (magic == "P6") {
+                        if (!number(token(in), width) || !number(token(in), height) || !number(token(in), maxval)) {
+                            return false;
+                        }
+                        in.get(); // the single white space before the samples
+                    } else if (magic == "P7") {
+                        std::string key;
+                        while ((key = token(in)) != "ENDHDR") {
+                            if (key.empty()) {
+                                return false;
+                            }
+                            std::string value = token(in);
+                            bool ok = true;
+                            if (key == "WIDTH") {
+                                ok = number(value, width);
+                            } else if (key == "HEIGHT") {
+                                ok = number(value, height);
+                            } else if (key == "DEPTH") {
+                                ok = number(value, depth) && depth >= 1 && depth <= 4;
+                            } else if (key == "MAXVAL") {
+                                ok = number(value, maxval);
+                            }
+                            // TUPLTYPE is implied by DEPTH
+                            if (!ok) {
+                                return false;
+                            }
+                        }
+                        // ENDHDR ends its line
+                        while (in && in.get() != '\n') {
+                        }
+                    } else {
+                        return false;
+                    }
+                    if (width <= 0 || height <= 0 || width > INT_MAX || height > INT_MAX ||
+                        maxval <= 0 || maxval > 65535 || !in) {
+                        return false;
+                    }
+                    w = (int) width;
+                    h = (int) height;
+                    offset = (size_t) in.tellg();
+                    return true;
+                }
+
+                // The samples are exactly the image's buffer format.
+                bool raw() const {
+                    return depth == 3 && maxval == 255;
+                }
+
+                size_t samples_offset() const {
+                    return offset;
+                }
+
+                bool read(color* pixels, int rows) {
+                    rgb_value* out = reinterpret_cast<rgb_value*>(pixels);
+                    if (raw()) {
+                        return (bool) in.read(reinterpret_cast<char*>(out), (std::streamsize) w * rows * 3);
+                    }
+                    int bytes = maxval > 255 ? 2 : 1;
+                    int color_samples = depth >= 3 ? 3 : 1;
+                    row.resize((size_t) w * depth * bytes);
+                    for (int y = 0; y < rows; y++) {
+                        if (!in.read(reinterpret_cast<char*>(row.data()), row.size())) {
+                            return false;
+                        }
+                        for (long x = 0; x < w; x++) {
+                            rgb_value v[3];
+                            for (int s = 0; s < color_samples; s++) {
+                                const uint8_t* p = &row[(x * depth + s) * bytes];
+                                long sample = bytes == 2 ? (p[0] << 8 | p[1]) : p[0];
+                                v[s] = (rgb_value) ((std::min(sample, maxval) * 255 + maxval / 2) / maxval);
+                            }
+                            rgb_value* q = out + 3 * ((size_t) y * w + x);
+                            q[0] = v[0];
+                            q[1] = v[color_samples == 3 ? 1 : 0];
+                            q[2] = v[color_samples == 3 ? 2 : 0];
+                        }
+                    }
+                    return true;
+                }
+
+            private:
+                std::ifstream in;
+                long depth, maxval;
+                size_t offset;
+                std::vector<uint8_t> row;
+            };
+
+            // Written to a temporary file that then replaces the target on
+            // close(), so that an image mapped from the target (e.g. "open x.ppm
+            // ... save x.ppm") keeps its pages instead of seeing the file
+            // truncated under it.
+            class pnm_writer : public writer {
+            public:
+                ~pnm_writer() {
+                    if (out.is_open()) {
+                        out.close();
+                        std::remove(tmp.c_str()); // never closed
+                    }
+                }
+
+                bool open(const std::string& file, const std::string& header) {
+                    target = file;
+                    tmp = file + ".tmp";
+                    out.open(tmp.c_str(), std::ios::binary);
+                    out << header;
+                    return (bool) out;
+                }
+
+                bool write(const image_view& view) {
+                    // strided views are written row by row, without a copy
+                    for (int y = 0; y < view.height(); y++) {
+                        out.write(reinterpret_cast<const char*>(view.row(y)), (std::streamsize) view.width() * 3);
+                    }
+                    return (bool) out;
+                }
+
+                bool close() {
+                    bool ok = (bool) out.flush();
+                    out.close();
+                    if (!ok) {
+                        std::remove(tmp.c_str());
+                        return false;
+                    }
+                    return std::rename(tmp.c_str(), target.c_str()) == 0;
+                }
+
+            private:
+                std::string target, tmp;
+                std::ofstream out;
+            };
+
+            writer* create(const std::string& file, const std::string& header) {
+                std::unique_ptr<pnm_writer> w(new pnm_writer());
+                return w->open(file, header) ? w.release() : NULL;
+            }
+
+            bool save(writer* w, const image_view& view) {
+                std::unique_ptr<writer> owned(w);
+                return w != NULL && w->write(view) && w->close();
+            }
+        }
+
+        reader* open_reader(const std::string& file) {
+            std::unique_ptr<pnm_reader> r(new pnm_reader());
+            return r->open(file) ? r.release() : NULL;
+        }
+
+        writer* open_ppm_writer(const std::string& file, int width, int height) {
+            return create(file, "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n");
+        }
+
+        writer* open_pam_writer(const std::string& file, int width, int height) {
+            return create(file, "P7\nWIDTH " + std::to_string(width) + "\nHEIGHT " + std::to_string(height) +
+                                "\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n");
+        }
+
+        image* load(const std::string& file) {
+            pnm_reader r;
+            if (!r.open(file)) {
+                return NULL;
+            }
+            size_t n = (size_t) r.width() * r.height();
+            if (r.raw() && n * 3 >= MAP_THRESHOLD) {
+                // the samples are already in the image's format: use them in place
+                std::shared_ptr<color> mapped = map_samples(file, r.samples_offset(), n * 3);
+                if (mapped) {
+                    return new image(r.width(), r.height(), mapped);
+                }
+            }
+            std::shared_ptr<color> pixels = image::allocate(n);
+            if (!r.read(pixels.get(), r.height())) {
+                return NULL;
+            }
+            return new image(r.width(), r.height(), pixels);
+        }
+
+        bool save_ppm(const std::string& file, const image_view& view) {
+            return save(open_ppm_writer(file, view.width(), view.height()), view);
+        }
+
+        bool save_pam(const std::string& file, const image_view& view) {
+            return save(open_pam_writer(file, view.width(), view.height()), view);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef __png_pnm_hpp__
+#define __png_pnm_hpp__
+
+#include <string>
+#include <rgb/image.hpp>
+#include <rgb/image_view.hpp>
+#include <png/stream.hpp>
+
+namespace png {
+    //! Binary Netpbm files: PPM (P6) and PAM (P7), i.e. a small text header
+    //! followed by the raw samples.
+    namespace pnm {
+        //! Load an image from a PPM or PAM file.
+        //! PAM files may be RGB, RGB_ALPHA, GRAYSCALE or GRAYSCALE_ALPHA (alpha
+        //! is dropped); 16-bit samples are reduced to 8 bits.
+        //! Large 8-bit RGB files are not read but memory-mapped (privately): the
+        //! image uses the page cache directly, so opening is immediate and only
+        //! the pages actually used are loaded. Modifying the image copies the
+        //! pages it touches and never changes the file. Other programs must not
+        //! truncate or rewrite the file in place while the image exists (save_ppm()
+        //! and save_pam() replace files instead, so saving over it is safe).
+        //! @param file File name.
+        //! @return A new image (dynamically allocated), or NULL on error.
+        rgb::image *load(const std::string &file);
+
+        //! Save an image view to a PPM file (P6, 8-bit).
+        //! @param file File name.
+        //! @param view View to save.
+        //! @return false if the file could not be written.
+        bool save_ppm(const std::string &file, const rgb::image_view &view);
+
+        //! Save an image view to a PAM file (P7, TUPLTYPE RGB, 8-bit).
+        //! @param file File name.
+        //! @param view View to save.
+        //! @return false if the file could not be written.
+        bool save_pam(const std::string &file, const rgb::image_view &view);
+
+        //! Open a PPM or PAM file to be read by rows (see png::open_reader()).
+        //! @param file File name.
+        //! @return A new reader (dynamically allocated), or NULL on error.
+        reader *open_reader(const std::string &file);
+
+        //! Create a PPM file to be written by rows (see png::open_writer()).
+        //! Like save_ppm(), it replaces the file only when the writer is closed.
+        //! @param file File name.
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @return A new writer (dynamically allocated), or NULL on error.
+        writer *open_ppm_writer(const std::string &file, int width, int height);
+
+        //! Create a PAM file to be written by rows (see png::open_writer()).
+        //! @param file File name.
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @return A new writer (dynamically allocated), or NULL on error.
+        writer *open_pam_writer(const std::string &file, int width, int height);
+    }
+}
+#endif
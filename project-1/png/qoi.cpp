@@ -0,0 +1,278 @@
+#include <png/qoi.hpp>
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+using namespace rgb;
+
+namespace png {
+    namespace qoi {
+        namespace {
+            const uint8_t OP_INDEX = 0x00;
+            const uint8_t OP_DIFF = 0x40;
+            const uint8_t OP_LUMA = 0x80;
+            const uint8_t OP_RUN = 0xC0;
+            const uint8_t OP_RGB = 0xFE;
+            const uint8_t OP_RGBA = 0xFF;
+            const uint8_t MASK = 0xC0;
+            const size_t HEADER = 14;
+            const uint8_t END[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+            // Bytes read from the file at a time; a chunk always holds a whole op.
+            const size_t CHUNK = 64 << 10;
+            // Largest image allowed by the spec, in pixels.
+            const uint64_t MAX_PIXELS = 400000000;
+            // Pixels one op can produce at most (OP_RUN).
+            const uint64_t MAX_RUN = 62;
+
+            struct rgba {
+                uint8_t r, g, b, a;
+                bool operator==(const rgba& o) const {
+                    return r == o.r && g == o.g && b == o.b && a == o.a;
+                }
+            };
+
+            int hash(const rgba& p) {
+                return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+            }
+
+            uint32_t get32(const uint8_t* p) {
+                return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+            }
+
+            void put32(std::vector<uint8_t>& out, uint32_t v) {
+                out.push_back(v >> 24);
+                out.push_back(v >> 16);
+                out.push_back(v >> 8);
+                out.push_back(v);
+            }
+
+            // The decoder state (index, previous pixel, pending run) carries
+            // over from one band of rows to the next.
+            class qoi_reader : public reader {
+            public:
+                qoi_reader() : data(CHUNK), pos(0), end(0), px(), run(0) {
+                    memset(index, 0, sizeof(index));
+                    px.a = 255;
+                }
+
+                bool open(const std::string& file) {
+                    in.open(file.c_str(), std::ios::binary | std::ios::ate);
+                    uint64_t size = in ? (uint64_t) in.tellg() : 0;
+                    in.seekg(0);
+                    refill();
+                    if (end < HEADER || memcmp(data.data(), "qoif", 4) != 0) {
+                        return false;
+                    }
+                    uint32_t width = get32(&data[4]), height = get32(&data[8]);
+                    int channels = data[12];
+                    if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX ||
+                        (uint64_t) width * height > MAX_PIXELS || (channels != 3 && channels != 4)) {
+                        return false;
+                    }
+                    // a corrupt header must not make load() allocate more than the
+                    // file could ever describe: each op byte gives at most MAX_RUN pixels
+                    if (size < HEADER + ((uint64_t) width * height + MAX_RUN - 1) / MAX_RUN + sizeof(END)) {
+                        return false;
+                    }
+                    w = (int) width;
+                    h = (int) height;
+                    pos = HEADER;
+                    return true;
+                }
+
+                bool read(color* pixels, int rows) {
+                    uint8_t* out = reinterpret_cast<uint8_t*>(pixels);
+                    size_t n = (size_t) w * rows;
+                    for (size_t i = 0; i < n; i++) {
+                        if (run > 0) {
+                            run--;
+                        } else {
+                            if (end - pos < 5) {
+                                refill();
+                                if (pos == end) {
+                                    return false; // truncated
+                                }
+                            }
+                            uint8_t op = data[pos++];
+                            if (op == OP_RGB) {
+                                if (end - pos < 3) {
+                                    return false;
+                                }
+                                px.r = data[pos];
+                                px.g = data[pos + 1];
+                                px.b = data[pos + 2];
+                                pos += 3;
+                            } else if (op == OP_RGBA) {
+                                if (end - pos < 4) {
+                                    return false;
+                                }
+                                px.r = data[pos];
+                                px.g = data[pos + 1];
+                                px.b = data[pos + 2];
+                                px.a = data[pos + 3];
+                                pos += 4;
+                            } else if ((op & MASK) == OP_INDEX) {
+                                px = index[op];
+                            } else if ((op & MASK) == OP_DIFF) {
+                                px.r += ((op >> 4) & 3) - 2;
+                                px.g += ((op >> 2) & 3) - 2;
+                                px.b += (op & 3) - 2;
+                            } else if ((op & MASK) == OP_LUMA) {
+                                if (pos == end) {
+                                    return false;
+                                }
+                                int vg = (op & 0x3F) - 32;
+                                uint8_t b2 = data[pos++];
+                                px.r += vg - 8 + ((b2 >> 4) & 0x0F);
+                                px.g += vg;
+                                px.b += vg - 8 + (b2 & 0x0F);
+                            } else {
+                                run = op & 0x3F;
+                            }
+                            index[hash(px)] = px;
+                        }
+                        out[3 * i] = px.r;
+                        out[3 * i + 1] = px.g;
+                        out[3 * i + 2] = px.b;
+                    }
+                    return true;
+                }
+
+            private:
+                // Moves the unread bytes to the front and reads more after them.
+                void refill() {
+                    memmove(data.data(), data.data() + pos, end - pos);
+                    end -= pos;
+                    pos = 0;
+                    in.read(reinterpret_cast<char*>(data.data() + end), (std::streamsize) (data.size() - end));
+                    end += (size_t) in.gcount();
+                }
+
+                std::ifstream in;
+                std::vector<uint8_t> data;
+                size_t pos, end;
+                rgba index[64];
+                rgba px;
+                int run;
+            };
+
+            // Each band is encoded into a buffer that is then appended to the file.
+            class qoi_writer : public writer {
+            public:
+                qoi_writer() : prev(), run(0) {
+                    memset(index, 0, sizeof(index));
+                    prev.a = 255;
+                }
+
+                bool open(const std::string& file, int width, int height) {
+                    f.open(file.c_str(), std::ios::binary);
+                    out.insert(out.end(), "qoif", "qoif" + 4);
+                    put32(out, width);
+                    put32(out, height);
+                    out.push_back(3);
+                    out.push_back(0); // sRGB with linear alpha
+                    return flush();
+                }
+
+                bool write(const image_view& view) {
+                    int w = view.width();
+                    // worst case: one OP_RGB per pixel
+                    out.reserve((size_t) w * view.height() * 4);
+                    for (int y = 0; y < view.height(); y++) {
+                        const uint8_t* row = reinterpret_cast<const uint8_t*>(view.row(y));
+                        for (int x = 0; x < w; x++) {
+                            rgba px = {row[3 * x], row[3 * x + 1], row[3 * x + 2], 255};
+                            if (px == prev) {
+                                run++;
+                                if (run == 62) {
+                                    out.push_back(OP_RUN | (run - 1));
+                                    run = 0;
+                                }
+                                continue;
+                            }
+                            if (run > 0) {
+                                out.push_back(OP_RUN | (run - 1));
+                                run = 0;
+                            }
+                            int h6 = hash(px);
+                            if (index[h6] == px) {
+                                out.push_back(OP_INDEX | h6);
+                            } else {
+                                index[h6] = px;
+                                // the alpha never changes, so the differences always apply
+                                int8_t vr = px.r - prev.r, vg = px.g - prev.g, vb = px.b - prev.b;
+                                int8_t vg_r = vr - vg, vg_b = vb - vg;
+                                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                                    out.push_back(OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                                    out.push_back(OP_LUMA | (vg + 32));
+                                    out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+                                } else {
+                                    out.push_back(OP_RGB);
+                                    out.push_back(px.r);
+                                    out.push_back(px.g);
+                                    out.push_back(px.b);
+                                }
+                            }
+                            prev = px;
+                        }
+                    }
+                    return flush();
+                }
+
+                bool close() {
+                    if (run > 0) {
+                        out.push_back(OP_RUN | (run - 1));
+                        run = 0;
+                    }
+                    out.insert(out.end(), END, END + sizeof(END));
+                    return flush() && f.flush();
+                }
+
+            private:
+                bool flush() {
+                    f.write(reinterpret_cast<const char*>(out.data()), out.size());
+                    out.clear();
+                    return (bool) f;
+                }
+
+                std::ofstream f;
+                std::vector<uint8_t> out;
+                rgba index[64];
+                rgba prev;
+                int run;
+            };
+        }
+
+        reader* open_reader(const std::string& file) {
+            std::unique_ptr<qoi_reader> r(new qoi_reader());
+            return r->open(file) ? r.release() : NULL;
+        }
+
+        writer* open_writer(const std::string& file, int width, int height) {
+            std::unique_ptr<qoi_writer> w(new qoi_writer());
+            return w->open(file, width, height) ? w.release() : NULL;
+        }
+
+        image* load(const std::string& file) {
+            std::unique_ptr<reader> r(open_reader(file));
+            if (!r) {
+                return NULL;
+            }
+            std::shared_ptr<color> pixels = image::allocate((size_t) r->width() * r->height());
+            if (!r->read(pixels.get(), r->height())) {
+                return NULL;
+            }
+            return new image(r->width(), r->height(), pixels);
+        }
+
+        bool save(const std::string& file, const image_view& view) {
+            std::unique_ptr<writer> w(open_writer(file, view.width(), view.height()));
+            return w && w->write(view) && w->close();
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef __png_qoi_hpp__
+#define __png_qoi_hpp__
+
+#include <string>
+#include <rgb/image.hpp>
+#include <rgb/image_view.hpp>
+#include <png/stream.hpp>
+
+namespace png {
+    //! The "Quite OK Image" format: lossless and much faster than PNG to
+    //! encode and decode, at similar sizes for flat-colour images.
+    namespace qoi {
+        //! Load an image from a QOI file (an alpha channel is dropped).
+        //! @param file File name.
+        //! @return A new image (dynamically allocated), or NULL on error.
+        rgb::image *load(const std::string &file);
+
+        //! Save an image view to a QOI file (3 channels, sRGB).
+        //! @param file File name.
+        //! @param view View to save.
+        //! @return false if the file could not be written.
+        bool save(const std::string &file, const rgb::image_view &view);
+
+        //! Open a QOI file to be read by rows (see png::open_reader()).
+        //! @param file File name.
+        //! @return A new reader (dynamically allocated), or NULL on error.
+        reader *open_reader(const std::string &file);
+
+        //! Create a QOI file to be written by rows (see png::open_writer()).
+        //! @param file File name.
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @return A new writer (dynamically allocated), or NULL on error.
+        writer *open_writer(const std::string &file, int width, int height);
+    }
+}
+#endif
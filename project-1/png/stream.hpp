@@ -0,0 +1,65 @@
+#ifndef __png_stream_hpp__
+#define __png_stream_hpp__
+
+#include <string>
+#include <png/png.hpp>
+#include <rgb/color.hpp>
+#include <rgb/image_view.hpp>
+
+namespace png {
+    //! Reads an image file from top to bottom, a band of rows at a time, so
+    //! that the whole image never has to be in memory.
+    class reader {
+    public:
+        virtual ~reader() {}
+        //! @return Image width.
+        int width() const { return w; }
+        //! @return Image height.
+        int height() const { return h; }
+        //! Read the next rows.
+        //! @param out Room for rows * width() pixels, written row after row.
+        //! @param rows Number of rows (at most the rows not read yet).
+        //! @return false if the file is truncated or corrupt.
+        virtual bool read(rgb::color *out, int rows) = 0;
+    protected:
+        reader() : w(0), h(0) {}
+        int w, h;
+    };
+
+    //! Writes an image file from top to bottom, a band of rows at a time.
+    class writer {
+    public:
+        virtual ~writer() {}
+        //! Write the next rows.
+        //! @param rows View with the next rows, as wide as the image.
+        //! @return false if the file could not be written.
+        virtual bool write(const rgb::image_view &rows) = 0;
+        //! Finish the file, after all the rows have been written.
+        //! @return false if the file could not be written.
+        virtual bool close() = 0;
+    };
+
+    //! Open a QOI, PPM or PAM file (chosen by extension as in load()) to be read by rows.
+    //! @param file File name.
+    //! @return A new reader (dynamically allocated), or NULL on error or if the
+    //! format cannot be read by rows (PNG and JPEG files are only decoded whole).
+    reader *open_reader(const std::string &file);
+
+    //! Create a file to be written by rows, in the format given by its extension.
+    //! PNG files use the built-in encoder with the options given to
+    //! set_default_options(), or the default options if there were none.
+    //! @param file File name.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @return A new writer (dynamically allocated), or NULL if the file cannot be created.
+    writer *open_writer(const std::string &file, int width, int height);
+
+    //! Create a file to be written by rows; PNG files use the given options.
+    //! @param file File name.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param opts Compression level and row filter (ignored by the other formats).
+    //! @return A new writer (dynamically allocated), or NULL if the file cannot be created.
+    writer *open_writer(const std::string &file, int width, int height, const options &opts);
+}
+#endif
@@ -1,5 +1,6 @@
 
 
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -7,39 +8,43 @@
 
 int main(int argc, char** argv) {
     if (argc != 3) {
-        std::cout << "Usage: image_diff file1.png file2.png";
+        std::cout << "Usage: image_diff file1 file2 (.png, .qoi, .ppm or .pam)";
         return 1;
     }
     std::string file1(argv[1]);
     std::string file2(argv[2]);
-    rgb::image *img1 = png::load(file1);
-    if (img1 == NULL) {
+    rgb::image img1, img2;
+    if (!png::load(file1, img1)) {
         std::cout << "Could not load " << file1 << std::endl;
         return 1;
     }
     std::cout << "- Loaded " << file1
-              << " ( " << img1->width()
-              << " x " << img1->height()
+              << " ( " << img1.width()
+              << " x " << img1.height()
               << " )"  << std::endl;
-    rgb::image *img2 = png::load(file2);
-    if (img2 == NULL) {
+    if (!png::load(file2, img2)) {
         std::cout << "Could not load " << file2 << std::endl;
-        delete img1;
         return 1;
     }
     std::cout << "- Loaded " << file2
-              << " ( " << img2->width()
-              << " x " << img2->height()
+              << " ( " << img2.width()
+              << " x " << img2.height()
               << " )"  << std::endl;
-    bool eq = img1->width() == img2->width() &&
-              img1->height() == img2->height();
+    bool eq = img1.width() == img2.width() &&
+              img1.height() == img2.height();
     if (!eq) {
         std::cout << "- Different image dimensions!" << std::endl;
     } else {
-        for (int x = 0; x < img1->width() && eq ; x++) {
-            for (int y = 0; y < img1->height() && eq; y++) {
-                const rgb::color& c1 = img1 -> at(x, y);
-                const rgb::color& c2 = img2 -> at(x, y);
+        rgb::image_view v1 = img1.view(), v2 = img2.view();
+        size_t row_bytes = sizeof(rgb::color) * img1.width();
+        for (int y = 0; y < img1.height() && eq; y++) {
+            // rgb::color is 3 packed bytes: equal rows have equal bytes
+            if (memcmp(v1.row(y), v2.row(y), row_bytes) == 0) {
+                continue;
+            }
+            for (int x = 0; x < img1.width() && eq ; x++) {
+                const rgb::color& c1 = v1.row(y)[x];
+                const rgb::color& c2 = v2.row(y)[x];
                 eq = (c1 == c2);
                 if (!eq) {
                     std::cout << "- Pixel (" << x << ',' << y << ") is different: "
@@ -58,7 +63,5 @@ int main(int argc, char** argv) {
     if (eq) {
         std::cout << "- No differences found!" << std::endl;
     }
-    delete img1;
-    delete img2;
     return eq ? 0 : 1;
 }
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <rgb/rgb.hpp>
+
+// Times png::save with each PNG encoder setting, and with the QOI and PPM
+// formats, and checks that the file decodes back to the same pixels.
+
+static bool same_pixels(const rgb::image& a, const rgb::image& b) {
+    if (a.width() != b.width() || a.height() != b.height()) {
+        return false;
+    }
+    for (int y = 0; y < a.height(); y++) {
+        for (int x = 0; x < a.width(); x++) {
+            if (!(a.at(x, y) == b.at(x, y))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static long file_size(const std::string& file) {
+    std::FILE* f = std::fopen(file.c_str(), "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    std::fseek(f, 0, SEEK_END);
+    long size = std::ftell(f);
+    std::fclose(f);
+    return size;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "Usage: png_bench file.png ... (writes png_bench.tmp.* in the current directory)" << std::endl;
+        return 1;
+    }
+    const char* settings[] = {"stb", "store", "fast", "level 1 filter paeth", "level 3", "level 6",
+                              "level 6 filter up", "best", "qoi", "ppm"};
+    for (int a = 1; a < argc; a++) {
+        std::unique_ptr<rgb::image> img(png::load(argv[a]));
+        if (!img) {
+            std::cout << "Could not load " << argv[a] << std::endl;
+            return 1;
+        }
+        std::cout << argv[a] << " (" << img->width() << " x " << img->height() << ")" << std::endl;
+        for (const char* setting : settings) {
+            std::string name(setting);
+            std::string out = "png_bench.tmp." + (name == "qoi" || name == "ppm" ? name : std::string("png"));
+            png::options opts;
+            if (out.find(".png") != std::string::npos && name != "stb") {
+                png::options::parse(name, opts);
+            }
+            double best = 0;
+            for (int run = 0; run < 3; run++) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                if (name == "stb" || out.find(".png") == std::string::npos) {
+                    png::save(out, img.get());
+                } else {
+                    png::save(out, img.get(), opts);
+                }
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                best = run == 0 || ms < best ? ms : best;
+            }
+            std::unique_ptr<rgb::image> back(png::load(out));
+            std::cout << "  " << std::left << std::setw(22) << name << std::right
+                      << std::setw(10) << std::fixed << std::setprecision(1) << best << " ms"
+                      << std::setw(12) << file_size(out) << " bytes"
+                      << (back && same_pixels(*img, *back) ? "" : "  MISMATCH") << std::endl;
+            std::remove(out.c_str());
+        }
+    }
+    return 0;
+}
@@ -1,9 +1,176 @@
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
 #include <rgb/rgb.hpp>
+#include <rgb/batch.hpp>
+#include <rgb/parallel.hpp>
+#include <rgb/trace.hpp>
+
+// Parses a non-negative decimal integer (0 means "off" or "one per core" for
+// the options that take one); rejects signs, garbage and out-of-range values.
+static bool parse_count(const char* text, int& value) {
+    if (*text < '0' || *text > '9') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    long n = std::strtol(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || n > INT_MAX) {
+        return false;
+    }
+    value = (int) n;
+    return true;
+}
+
+static int usage() {
+    std::cout << "Usage: run_script [--threads N] [--jobs N] [--cache-mb N] [--save OPTIONS] [--stream ROWS] [--scratch DIR] [--profile FILE] [--trace FILE] [--mem-report] [--mem-budget N] [--script-mb N] [--explain] script.txt ..." << std::endl
+              << "  --threads N     worker threads for image operations (0 = one per core)" << std::endl
+              << "  --jobs N        run N scripts at once (0 = one per core); output is kept in script order" << std::endl
+              << "  --cache-mb N    memory budget of the decoded image cache in MiB (0 disables it)" << std::endl
+              << "  --save OPTIONS  PNG encoder settings for saves without their own, e.g. \"fast\", \"store\"," << std::endl
+              << "                  \"best\" or \"level 3 filter paeth\" (filters: none sub up average paeth adaptive)" << std::endl
+              << "  --stream ROWS   run open ... save sequences without crop or rotations ROWS rows at a time," << std::endl
+              << "                  never holding the whole image (QOI, PPM and PAM inputs are read by rows)" << std::endl
+              << "  --scratch DIR   keep images of 64 MiB or more in temporary files in DIR, paged in and" << std::endl
+              << "                  out by the system, so they can be larger than the available memory" << std::endl
+              << "  --profile FILE  time every command and print a summary table at the end; the time," << std::endl
+              << "                  pixels, allocated bytes and image size of each command are written" << std::endl
+              << "                  to FILE as JSON" << std::endl
+              << "  --trace FILE    write a timeline of loads, saves, commands and image operations to" << std::endl
+              << "                  FILE as Chrome trace events, one track per thread (open it in Perfetto)" << std::endl
+              << "  --mem-report    print the peak memory of image buffers of each script and of each command" << std::endl
+              << "  --mem-budget N  stop a script as soon as the live image buffers would exceed N MiB" << std::endl
+              << "  --script-mb N   stop a script as soon as its own live image buffers would exceed N MiB" << std::endl
+              << "  --explain       print the optimized plan of each script instead of running it" << std::endl;
+    return 1;
+}
 
 int main(int argc, char** argv) {
+    bool explain = false;
+    bool batch = false;
+    int jobs = 0;
+    int band_rows = 0;
+    std::vector<std::string> scripts;
+    std::string profile_file;
+    std::string trace_file;
+    bool mem_report = false;
+    size_t script_budget = 0;
     for (int i = 1; i < argc; i++) {
-        rgb::script s(argv[i]);
-        s.process();
+        std::string arg(argv[i]);
+        if (arg == "--threads" || arg == "--jobs" || arg == "--cache-mb" || arg == "--stream" || arg == "--mem-budget" ||
+            arg == "--script-mb") {
+            if (i + 1 == argc) {
+                return usage();
+            }
+            int value;
+            if (!parse_count(argv[++i], value)) {
+                return usage();
+            }
+            bool mib = arg == "--cache-mb" || arg == "--mem-budget" || arg == "--script-mb";
+            if (mib && (size_t) value > (SIZE_MAX >> 20)) {
+                return usage();
+            }
+            if (arg == "--threads") {
+                rgb::parallel::set_threads(value);
+            } else if (arg == "--jobs") {
+                batch = true;
+                jobs = value;
+            } else if (arg == "--stream") {
+                band_rows = value;
+            } else if (arg == "--mem-budget") {
+                rgb::memory::total().set_budget((size_t) value << 20);
+            } else if (arg == "--script-mb") {
+                script_budget = (size_t) value << 20;
+            } else {
+                rgb::image_cache::shared().set_budget((size_t) value << 20);
+            }
+            continue;
+        }
+        if (arg == "--save") {
+            png::options opts;
+            if (i + 1 == argc || !png::options::parse(argv[++i], opts)) {
+                return usage();
+            }
+            png::set_default_options(opts);
+            continue;
+        }
+        if (arg == "--scratch") {
+            if (i + 1 == argc) {
+                return usage();
+            }
+            rgb::image::use_scratch(argv[++i], (size_t) 64 << 20);
+            continue;
+        }
+        if (arg == "--profile" || arg == "--trace") {
+            if (i + 1 == argc) {
+                return usage();
+            }
+            (arg == "--profile" ? profile_file : trace_file) = argv[++i];
+            continue;
+        }
+        if (arg == "--mem-report") {
+            mem_report = true;
+            continue;
+        }
+        if (arg == "--explain") {
+            explain = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") == 0) {
+            return usage();
+        }
+        scripts.push_back(arg);
+    }
+    if (!trace_file.empty()) {
+        rgb::trace::name_thread("main");
+        rgb::trace::start();
+    }
+    rgb::profile prof;
+    rgb::profile* p = profile_file.empty() && !mem_report ? NULL : &prof;
+    if (batch) {
+        rgb::batch::run(scripts, jobs, std::cout, explain, band_rows, p, script_budget);
+    } else {
+        for (const std::string& file : scripts) {
+            rgb::script s(file);
+            s.set_band_rows(band_rows);
+            s.set_profile(p);
+            s.set_memory_budget(script_budget);
+            if (explain) {
+                s.explain(std::cout);
+            } else {
+                s.process();
+            }
+        }
+    }
+    if (!trace_file.empty()) {
+        rgb::trace::stop();
+        std::ofstream json(trace_file.c_str());
+        rgb::trace::write(json);
+        if (!json) {
+            std::cerr << "Could not write " << trace_file << std::endl;
+            return 1;
+        }
+    }
+    if (mem_report) {
+        rgb::memory::account& all = rgb::memory::total();
+        std::cout << "Memory: peak " << (all.peak() >> 10) << " KiB of image buffers, " << all.allocations()
+                  << " allocations" << std::endl;
+        prof.print_memory(std::cout);
+    }
+    if (!profile_file.empty()) {
+        prof.print_table(std::cout);
+        std::ofstream json(profile_file.c_str());
+        prof.write_json(json);
+        if (!json) {
+            std::cerr << "Could not write " << profile_file << std::endl;
+            return 1;
+        }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <rgb/batch.hpp>
+#include <rgb/script.hpp>
+#include <rgb/trace.hpp>
+
+namespace rgb {
+    namespace batch {
+        namespace {
+            //! Scripts atribuídos a uma thread, identificados pela posição na lista
+            struct queue {
+                std::mutex m;
+                std::deque<int> tasks;
+            };
+
+            //! Estado partilhado pelas threads de um run()
+            struct state {
+                const std::vector<std::string>* files;
+                bool explain;
+                int band_rows;
+                profile* prof;
+                size_t memory_budget;
+                std::vector<std::unique_ptr<queue> > queues;
+                std::vector<std::string> outputs;
+                std::vector<bool> done;
+                std::mutex m;
+                std::condition_variable finished;
+
+                //! Obtem o próximo script: primeiro da própria fila, depois do fim das outras
+                bool take(int self, int& task) {
+                    int n = (int) queues.size();
+                    for(int k = 0 ; k < n ; k++){
+                        queue& q = *queues[(self + k) % n];
+                        std::lock_guard<std::mutex> lock(q.m);
+                        if (q.tasks.empty()) {
+                            continue;
+                        }
+                        if (k == 0) {
+                            task = q.tasks.front();
+                            q.tasks.pop_front();
+                        } else {
+                            task = q.tasks.back();
+                            q.tasks.pop_back();
+                        }
+                        return true;
+                    }
+                    return false;
+                }
+
+                void work(int self) {
+                    trace::name_thread("job " + std::to_string(self));
+                    int task;
+                    while (take(self, task)) {
+                        std::ostringstream log;
+                        // uma exceção que escape a um script (process() só trata a falta de
+                        // memória) fica nas suas mensagens em vez de terminar o lote todo
+                        try {
+                            script s((*files)[task]);
+                            s.set_band_rows(band_rows);
+                            s.set_profile(prof);
+                            s.set_memory_budget(memory_budget);
+                            if (explain) {
+                                s.explain(log);
+                            } else {
+                                s.process(log);
+                            }
+                        } catch (const std::exception& e) {
+                            log << "Error: " << e.what() << "! Stopping ..." << std::endl;
+                        } catch (...) {
+                            log << "Unknown error! Stopping ..." << std::endl;
+                        }
+                        std::lock_guard<std::mutex> lock(m);
+                        outputs[task] = log.str();
+                        done[task] = true;
+                        finished.notify_all();
+                    }
+                }
+            };
+        }
+
+        void run(const std::vector<std::string>& files, int jobs, std::ostream& out, bool explain, int band_rows,
+                 profile* prof, size_t memory_budget) {
+            if (jobs <= 0) {
+                jobs = (int) std::thread::hardware_concurrency();
+            }
+            jobs = std::max(1, std::min<int>(jobs, (int) files.size()));
+            state st;
+            st.files = &files;
+            st.explain = explain;
+            st.band_rows = band_rows;
+            st.prof = prof;
+            st.memory_budget = memory_budget;
+            st.outputs.resize(files.size());
+            st.done.assign(files.size(), false);
+            for(int t = 0 ; t < jobs ; t++){
+                st.queues.push_back(std::unique_ptr<queue>(new queue()));
+            }
+            // blocos contíguos: cada thread começa por scripts vizinhos na lista
+            for(size_t i = 0 ; i < files.size() ; i++){
+                st.queues[i * jobs / files.size()]->tasks.push_back((int) i);
+            }
+            std::vector<std::thread> workers;
+            for(int t = 0 ; t < jobs ; t++){
+                workers.push_back(std::thread(&state::work, &st, t));
+            }
+            // escreve cada bloco assim que ele e todos os anteriores estão prontos
+            for(size_t i = 0 ; i < files.size() ; i++){
+                std::string text;
+                {
+                    std::unique_lock<std::mutex> lock(st.m);
+                    st.finished.wait(lock, [&st, i] { return st.done[i]; });
+                    text.swap(st.outputs[i]);
+                }
+                out << "==> " << files[i] << " <==" << std::endl << text << std::flush;
+            }
+            for (std::thread& t : workers) {
+                t.join();
+            }
+        }
+    }
+}
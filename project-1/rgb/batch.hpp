@@ -0,0 +1,37 @@
+//! @file batch.hpp
+#ifndef __rgb_batch_hpp__
+#define __rgb_batch_hpp__
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <rgb/profile.hpp>
+
+namespace rgb {
+    //! Execução de muitos scripts ao mesmo tempo
+    //!
+    //! os scripts são repartidos por várias threads; uma thread que fique sem
+    //! scripts rouba os que ainda não começaram nas outras. As imagens lidas vêm
+    //! da cache partilhada (rgb::image_cache::shared()), por isso um ficheiro usado
+    //! por vários scripts só é descodificado uma vez
+    namespace batch {
+        //! Executa (ou explica) uma lista de scripts em paralelo
+        //!
+        //! as mensagens de cada script são guardadas e escritas em bloco, pela ordem
+        //! da lista e precedidas de uma linha "==> ficheiro <=="; uma exceção lançada
+        //! por um script é escrita nas mensagens dele e não interrompe os outros
+        //! \param files nomes dos ficheiros dos scripts
+        //! \param jobs número de scripts a correr ao mesmo tempo (0 usa o número de cores da máquina)
+        //! \param out stream onde escrever as mensagens
+        //! \param explain se true escreve o plano de cada script em vez de o executar
+        //! \param band_rows se for maior que 0, os scripts são executados por bandas
+        //! com este número de linhas (ver script::set_band_rows())
+        //! \param prof perfil onde todos os scripts registam as medições (NULL para não medir)
+        //! \param memory_budget máximo de bytes de pixeis vivos de cada script (ver
+        //! script::set_memory_budget(); 0 para não haver limite)
+        void run(const std::vector<std::string>& files, int jobs, std::ostream& out, bool explain = false,
+                 int band_rows = 0, profile* prof = NULL, size_t memory_budget = 0);
+    }
+}
+#endif
@@ -2,11 +2,18 @@
 #ifndef __rgb_color_hpp__
 #define __rgb_color_hpp__
 
+#include <cstdint>
 #include <iostream>
+#include <type_traits>
 
 namespace rgb {
     typedef unsigned char rgb_value;
 
+    //! Cor RGB com 3 bytes, trivialmente copiável
+    //!
+    //! os buffers de pixeis são arrays de color, por isso copiar pixeis é copiar
+    //! bytes (memcpy) e o compilador pode vetorizar os ciclos; as funções são
+    //! inline e sem ramos para poderem ser usadas nesses ciclos
     class color {
     private:
         //! Campo para guardar a componente red de uma color
@@ -39,21 +46,17 @@ namespace rgb {
         //! Construtor de uma cor por omissão
         //!
         //! inicializa todas as componentes RGB com valor 0
-        color();
-        //! Construtor de uma cor por cópia de outra
-        //!
-        //! \param c cor a copiar
-        color(const color& c);
+        constexpr color() : r(0), g(0), b(0) {}
         //! Construtor que usa valores fornecidos para inicializar as componentes RGB
         //!
         //! \param r componente red
         //! \param g componente green
         //! \param b componente blue
-        color(rgb_value r, rgb_value g, rgb_value b);
+        constexpr color(rgb_value r, rgb_value g, rgb_value b) : r(r), g(g), b(b) {}
         //! Obtem valor para a componente red
         //!
         //! \return valor da componente red
-        rgb_value red() const;
+        constexpr rgb_value red() const { return r; }
         //! Obtem referência para a componente red
         //!
         //! \return referência da componente red
@@ -61,7 +64,7 @@ namespace rgb {
         //! Obtem valor para a componente green
         //!
         //! \return valor da componente green
-        rgb_value green() const;
+        constexpr rgb_value green() const { return g; }
         //! Obtem referência para a componente green
         //!
         //! \return referência da componente green
@@ -69,26 +72,26 @@ namespace rgb {
         //! Obtem valor para a componente blue
         //!
         //! \return valor da componente blue
-        rgb_value blue() const;
+        constexpr rgb_value blue() const { return b; }
         //! Obtem referência para a componente blue
         //!
         //! \return referência da componente blue
         rgb_value& blue();
-        //! Operador de atribuição
+        //! Obtem as três componentes num inteiro (red nos bits 0-7, green em 8-15, blue em 16-23)
         //!
-        //! \param c cor a igualar
-        //! \return rgb::color
-        color& operator=(const color& c);
+        //! \return componentes empacotadas
+        constexpr uint32_t packed() const { return (uint32_t) r | (uint32_t) g << 8 | (uint32_t) b << 16; }
         //! Operador de igualdade
         //!
+        //! compara as componentes empacotadas, sem ramos
         //! \param c cor a comparar
         //! \return booleano '0' ou '1'
-        bool operator==(const color &c) const;
+        constexpr bool operator==(const color &c) const { return packed() == c.packed(); }
         //! Operador de desigualdade
         //!
         //! \param c cor a comparar
         //! \return booleano '0' ou '1'
-        bool operator!=(const color &c) const;
+        constexpr bool operator!=(const color &c) const { return packed() != c.packed(); }
         //! Função para inverter a cor
         void invert();
         //! Função para converter a cor para uma escala de cinzento
@@ -99,5 +102,37 @@ namespace rgb {
         //! \param f fator
         void mix(const color& c, int f);
     };
+
+    static_assert(std::is_trivially_copyable<color>::value && sizeof(color) == 3,
+                  "os buffers de pixeis são copiados byte a byte");
+
+    inline rgb_value& color::red() {
+        return r;
+    }
+
+    inline rgb_value& color::green() {
+        return g;
+    }
+
+    inline rgb_value& color::blue() {
+        return b;
+    }
+
+    inline void color::invert() {
+        r = 255 - r;
+        g = 255 - g;
+        b = 255 - b;
+    }
+
+    inline void color::to_gray_scale() {
+        rgb_value gray = (r + g + b) / 3;
+        r = g = b = gray;
+    }
+
+    inline void color::mix(const color& c, int f) {
+        r = (((100 - f) * r) + (f * c.r)) / 100;
+        g = (((100 - f) * g) + (f * c.g)) / 100;
+        b = (((100 - f) * b) + (f * c.b)) / 100;
+    }
 }
 #endif
@@ -1,23 +1,332 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <rgb/image.hpp>
+#include <rgb/kernels.hpp>
+#include <rgb/memory.hpp>
+#include <rgb/parallel.hpp>
+#include <rgb/pixel_pool.hpp>
+#include <rgb/trace.hpp>
 
 namespace rgb {
+    namespace {
+        //! Interseção do intervalo [pos, pos + len) com [0, limit)
+        //!
+        //! \return false se a interseção for vazia
+        bool clip(int pos, int len, int limit, int& begin, int& end) {
+            long long b = pos < 0 ? 0 : pos;
+            long long e = (long long) pos + len;
+            if(e > limit){
+                e = limit;
+            }
+            if(b >= e){
+                return false;
+            }
+            begin = (int) b;
+            end = (int) e;
+            return true;
+        }
+
+        //! Diretoria dos ficheiros temporários (vazia se não forem usados)
+        std::string scratch_dir;
+        //! Tamanho, em bytes, a partir do qual os buffers vão para um ficheiro temporário
+        size_t scratch_min = 0;
+
+        //! Liberta um buffer obtido com allocate_pixels() (ou devolve-o à reserva de
+        //! onde veio) e devolve os bytes à conta
+        struct free_pixels {
+            std::shared_ptr<memory::account> owner;
+            size_t length;
+            bool mapped;
+            std::shared_ptr<pixel_pool> pool;
+            size_t capacity;
+            void operator()(color* p) const {
+                if(mapped){
+                    munmap(p, length);
+                }else if(pool){
+                    pool->give(reinterpret_cast<rgb_value*>(p), capacity);
+                }else{
+                    delete [] reinterpret_cast<rgb_value*>(p);
+                }
+                memory::release(owner, length);
+            }
+        };
+
+        //! Reserva length bytes num ficheiro temporário em scratch_dir
+        //!
+        //! o ficheiro é apagado logo a seguir a ser criado e só existe enquanto o
+        //! buffer estiver mapeado; como o mapeamento é partilhado, o sistema operativo
+        //! pode escrever no ficheiro as páginas que não estão a ser usadas e libertar a
+        //! memória, em vez de as manter residentes como as do heap
+        //! \return buffer mapeado, NULL se não for possível criar o ficheiro
+        color* scratch_pixels(size_t length) {
+            std::string name = scratch_dir + "/rgb-XXXXXX";
+            std::vector<char> path(name.begin(), name.end());
+            path.push_back('\0');
+            int fd = mkstemp(path.data());
+            if(fd < 0){
+                return NULL;
+            }
+            unlink(path.data());
+            void* p = MAP_FAILED;
+            if(ftruncate(fd, (off_t) length) == 0){
+                p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+            return p == MAP_FAILED ? NULL : static_cast<color*>(p);
+        }
+
+        //! Reserva um buffer para n pixeis sem os inicializar
+        //!
+        //! (new color[n] chamaria o construtor por omissão de cada pixel, o que é
+        //! uma passagem inútil pela memória quando todos vão ser escritos a seguir);
+        //! os buffers grandes vão para um ficheiro temporário, se image::use_scratch()
+        //! tiver sido chamada, e os outros vêm da reserva da thread (pixel_pool::scope),
+        //! se houver. O buffer fica registado na conta de memória atual (lança
+        //! std::bad_alloc se passar do orçamento)
+        std::shared_ptr<color> allocate_pixels(size_t n) {
+            size_t length = n * sizeof(color);
+            memory::count(length);
+            std::shared_ptr<memory::account> owner = memory::acquire(length);
+            if(!scratch_dir.empty() && length >= scratch_min){
+                color* mapped = scratch_pixels(length);
+                if(mapped != NULL){
+                    return std::shared_ptr<color>(mapped, free_pixels{owner, length, true, NULL, 0});
+                }
+            }
+            std::shared_ptr<pixel_pool> pool = pixel_pool::current();
+            size_t capacity = length;
+            rgb_value* p;
+            try{
+                p = pool ? pool->take(length, capacity) : new rgb_value[length];
+            }catch(const std::bad_alloc&){
+                memory::release(owner, length);
+                throw;
+            }
+            return std::shared_ptr<color>(reinterpret_cast<color*>(p), free_pixels{owner, length, false, pool, capacity});
+        }
+
+        //! Aplica f(primeiro pixel, número de pixeis) às linhas [y0, y1) de uma imagem
+        //!
+        //! quando as linhas são consecutivas em memória (stride == w) faz uma só chamada
+        template <class F>
+        void spans(color* p, int w, ptrdiff_t stride, int y0, int y1, F f) {
+            if(stride == w){
+                f(p + y0 * stride, (size_t) (y1 - y0) * w);
+                return;
+            }
+            for(int y = y0 ; y < y1 ; y++){
+                f(p + y * stride, (size_t) w);
+            }
+        }
+
+        //! Número de pixeis que image::apply() passa por todas as operações de cada vez
+        //!
+        //! (1024 pixeis são 3 KiB, que ficam na cache L1 entre operações)
+        const int APPLY_CHUNK = 1024;
+
+        //! Lado dos blocos usados nas rotações (32 x 32 pixeis de origem e de destino cabem na cache L1)
+        const int TILE = 32;
+
+        //! Preenche dst (dw x dh, linha a linha) com o pixel src[x * dx + y * dy] para cada posição (x,y)
+        //!
+        //! percorre o destino por blocos TILE x TILE, para que as leituras em coluna da
+        //! origem reutilizem as mesmas linhas de cache em vez de saltarem pela imagem toda
+        void remap_tiled(const color* src, ptrdiff_t dx, ptrdiff_t dy, color* dst, int dw, int dh) {
+            parallel::for_rows(dh, dw, [=](int y0, int y1) {
+                for(int ty = y0 ; ty < y1 ; ty += TILE){
+                    int ty1 = std::min(ty + TILE, y1);
+                    for(int tx = 0 ; tx < dw ; tx += TILE){
+                        int tx1 = std::min(tx + TILE, dw);
+                        for(int y = ty ; y < ty1 ; y++){
+                            color* out = dst + (size_t) y * dw;
+                            const color* in = src + y * dy;
+                            for(int x = tx ; x < tx1 ; x++){
+                                out[x] = in[x * dx];
+                            }
+                        }
+                    }
+                }
+            });
+        }
+    }
+
     image::image(int w, int h, const color& fill) {
         assert(h > 0 && w > 0);
         iwidth = w;
         iheight = h;
-        pixels = new color*[w];
-        color *data = new color[h*w];
-        for(int i = 0 ; i < w ; i++){
-            pixels[i] = data + i * h;
-            for(int j = 0 ; j < h ; j++){
-                pixels[i][j] = fill;
-            }
-        }
+        istride = w;
+        orientation = 0;
+        buffer = allocate_pixels((size_t) h*w);
+        pixels = buffer.get();
+        std::fill(pixels, pixels + (size_t) h*w, fill);
+    }
+
+    std::shared_ptr<color> image::allocate(size_t n) {
+        return allocate_pixels(n);
+    }
+
+    void image::use_scratch(const std::string& dir, size_t min_bytes) {
+        scratch_dir = dir;
+        scratch_min = min_bytes;
+    }
+
+    image::image(int w, int h, std::shared_ptr<color> pixels) {
+        assert(h > 0 && w > 0 && pixels);
+        iwidth = w;
+        iheight = h;
+        istride = w;
+        orientation = 0;
+        buffer = pixels;
+        this->pixels = buffer.get();
+    }
+
+    image::image(const image_view& v) {
+        iwidth = v.width();
+        iheight = v.height();
+        istride = v.stride();
+        orientation = 0;
+        //o buffer continua partilhado: detach() copia-o antes de qualquer alteração
+        buffer = std::const_pointer_cast<color>(v.shared_buffer());
+        pixels = const_cast<color*>(v.row(0));
+    }
+
+    image::image() : iwidth(0), iheight(0), pixels(NULL), istride(0), orientation(0) {}
+
+    image::image(image&& other) noexcept :
+        iwidth(other.iwidth), iheight(other.iheight), buffer(std::move(other.buffer)),
+        pixels(other.pixels), istride(other.istride), orientation(other.orientation) {
+        other.iwidth = 0;
+        other.iheight = 0;
+        other.pixels = NULL;
+        other.istride = 0;
+        other.orientation = 0;
+    }
+
+    image& image::operator=(image&& other) noexcept {
+        //a imagem movida fica vazia, mesmo que seja esta
+        image moved(std::move(other));
+        swap(moved);
+        return *this;
     }
 
     image::~image() {
-        delete [] pixels[0];
-        delete [] pixels;
+    }
+
+    image image::clone() const {
+        if(empty()){
+            return image();
+        }
+        trace::span t("image", "image::clone");
+        int w = iwidth, h = iheight;
+        std::shared_ptr<color> copy = allocate_pixels((size_t) w*h);
+        color* dst = copy.get();
+        if(orientation == 0){
+            parallel::for_rows(h, w, [&](int y0, int y1) {
+                for(int j = y0 ; j < y1 ; j++){
+                    std::copy(pixels + j * istride, pixels + j * istride + w, dst + (size_t) j * w);
+                }
+            });
+        }else{
+            ptrdiff_t base, dx, dy;
+            steps(base, dx, dy);
+            remap_tiled(pixels + base, dx, dy, dst, w, h);
+        }
+        return image(w, h, copy);
+    }
+
+    void image::swap(image& other) noexcept {
+        std::swap(iwidth, other.iwidth);
+        std::swap(iheight, other.iheight);
+        buffer.swap(other.buffer);
+        std::swap(pixels, other.pixels);
+        std::swap(istride, other.istride);
+        std::swap(orientation, other.orientation);
+    }
+
+    bool image::empty() const {
+        return iwidth == 0;
+    }
+
+    int image::phys_width() const {
+        return orientation % 2 == 0 ? iwidth : iheight;
+    }
+
+    int image::phys_height() const {
+        return orientation % 2 == 0 ? iheight : iwidth;
+    }
+
+    void image::steps(ptrdiff_t& base, ptrdiff_t& dx, ptrdiff_t& dy) const {
+        ptrdiff_t last_col = phys_width() - 1;
+        ptrdiff_t last_row = (phys_height() - 1) * istride;
+        switch(orientation){
+            case 1: //(x,y) -> (y, h-1-x)
+                base = last_row; dx = -istride; dy = 1;
+                break;
+            case 2: //(x,y) -> (w-1-x, h-1-y)
+                base = last_row + last_col; dx = -1; dy = -istride;
+                break;
+            case 3: //(x,y) -> (w-1-y, x)
+                base = last_col; dx = istride; dy = -1;
+                break;
+            default:
+                base = 0; dx = 1; dy = istride;
+        }
+    }
+
+    void image::to_physical(int& x0, int& x1, int& y0, int& y1) const {
+        int pw = phys_width(), ph = phys_height();
+        int a0 = x0, a1 = x1, b0 = y0, b1 = y1;
+        switch(orientation){
+            case 1:
+                x0 = b0; x1 = b1; y0 = ph - a1; y1 = ph - a0;
+                break;
+            case 2:
+                x0 = pw - a1; x1 = pw - a0; y0 = ph - b1; y1 = ph - b0;
+                break;
+            case 3:
+                x0 = pw - b1; x1 = pw - b0; y0 = a0; y1 = a1;
+                break;
+        }
+    }
+
+    void image::materialize() {
+        if(orientation == 0){
+            return;
+        }
+        trace::span t("image", "image::materialize");
+        ptrdiff_t base, dx, dy;
+        steps(base, dx, dy);
+        std::shared_ptr<color> aux = allocate_pixels((size_t) iwidth*iheight);
+        remap_tiled(pixels + base, dx, dy, aux.get(), iwidth, iheight);
+        buffer = aux;
+        pixels = aux.get();
+        istride = iwidth;
+        orientation = 0;
+    }
+
+    void image::detach() {
+        if(buffer.use_count() == 1){
+            return;
+        }
+        trace::span t("image", "image::detach");
+        int pw = phys_width(), ph = phys_height();
+        std::shared_ptr<color> copy = allocate_pixels((size_t) pw*ph);
+        color* dst = copy.get();
+        parallel::for_rows(ph, pw, [&](int y0, int y1) {
+            for(int j = y0 ; j < y1 ; j++){
+                std::copy(pixels + j * istride, pixels + j * istride + pw, dst + (size_t) j * pw);
+            }
+        });
+        buffer = copy;
+        pixels = dst;
+        istride = pw;
     }
 
     int image::width() const {
@@ -29,163 +338,226 @@ namespace rgb {
     }
 
     color& image::at(int x, int y) {
-        return pixels[x][y];
+        detach();
+        ptrdiff_t base, dx, dy;
+        steps(base, dx, dy);
+        return pixels[base + x * dx + y * dy];
     }
 
     const color& image::at(int x, int y) const {
-        return pixels[x][y];
+        ptrdiff_t base, dx, dy;
+        steps(base, dx, dy);
+        return pixels[base + x * dx + y * dy];
     }
 
-    void image::invert() {
-        for(int i = 0 ; i < iwidth ; i++){
-            for(int j = 0 ; j < iheight ; j++){
-                pixels[i][j].invert();
-            }
+    color* image::data() {
+        materialize();
+        detach();
+        return pixels;
+    }
+
+    const color* image::data() const {
+        assert(orientation == 0);
+        return pixels;
+    }
+
+    ptrdiff_t image::stride() const {
+        return istride;
+    }
+
+    bool image::is_upright() const {
+        return orientation == 0;
+    }
+
+    image_view image::view() const {
+        return view(0, 0, iwidth, iheight);
+    }
+
+    image_view image::view(int x, int y, int w, int h) const {
+        assert(x >= 0 && y >= 0 && w > 0 && h > 0 && x + w <= iwidth && y + h <= iheight);
+        if(orientation == 0){
+            return image_view(buffer, pixels + y * istride + x, w, h, istride);
         }
+        //rotação pendente: a vista é sobre uma cópia já rodada da zona pedida
+        ptrdiff_t base, dx, dy;
+        steps(base, dx, dy);
+        std::shared_ptr<color> aux = allocate_pixels((size_t) w*h);
+        remap_tiled(pixels + base + x * dx + y * dy, dx, dy, aux.get(), w, h);
+        return image_view(aux, aux.get(), w, h, w);
+    }
+
+    void image::invert() {
+        trace::span t("image", "image::invert");
+        //operações por pixel não dependem da orientação: percorrem o buffer tal como está
+        detach();
+        int pw = phys_width();
+        parallel::for_rows(phys_height(), pw, [&](int y0, int y1) {
+            spans(pixels, pw, istride, y0, y1, kernels::invert);
+        });
     }
 
     void image::to_gray_scale() {
-        for(int i = 0 ; i < iwidth ; i++){
-            for(int j = 0 ; j < iheight ; j++){
-                pixels[i][j].to_gray_scale();
-            }
-        }
+        trace::span t("image", "image::to_gray_scale");
+        detach();
+        int pw = phys_width();
+        parallel::for_rows(phys_height(), pw, [&](int y0, int y1) {
+            spans(pixels, pw, istride, y0, y1, kernels::to_gray_scale);
+        });
     }
 
-    void image::fill(int x, int y, int w, int h, const color& c) {
-        for(int i = 0 ; i < iwidth ; i++){
-            for(int j = 0 ; j < iheight ; j++){
-                if(i >= x && i < (x + w)){
-                    if(j >= y && j < (y + h)){
-                        pixels[i][j] = c;
+    void image::apply(const std::vector<pixel_op>& ops) {
+        trace::span t("image", "image::apply");
+        //mix precisa das coordenadas da imagem direita; as outras operações não
+        for(const pixel_op& op : ops){
+            if(op.type() == pixel_op::MIX){
+                materialize();
+            }
+        }
+        detach();
+        int pw = phys_width();
+        parallel::for_rows(phys_height(), pw * ops.size(), [&](int y0, int y1) {
+            for(int j = y0 ; j < y1 ; j++){
+                color* row = pixels + j * istride;
+                for(int x = 0 ; x < pw ; x += APPLY_CHUNK){
+                    size_t n = std::min(APPLY_CHUNK, pw - x);
+                    for(const pixel_op& op : ops){
+                        op.run(row + x, x, j, n);
                     }
                 }
             }
+        });
+    }
+
+    void image::for_each_span(const std::function<void(color*, size_t)>& f) {
+        trace::span t("image", "image::apply");
+        detach();
+        int pw = phys_width();
+        parallel::for_rows(phys_height(), pw, [&](int y0, int y1) {
+            spans(pixels, pw, istride, y0, y1, std::cref(f));
+        });
+    }
+
+    void image::fill(int x, int y, int w, int h, const color& c) {
+        trace::span t("image", "image::fill");
+        //só são visitadas as linhas e colunas do retângulo que estão dentro da imagem
+        int x0, x1, y0, y1;
+        if(!clip(x, w, iwidth, x0, x1) || !clip(y, h, iheight, y0, y1)){
+            return;
         }
+        //cópia: c pode ser um pixel desta imagem, alterado pelas faixas
+        const color value = c;
+        detach();
+        to_physical(x0, x1, y0, y1);
+        parallel::for_rows(y1 - y0, x1 - x0, [&](int r0, int r1) {
+            for(int j = y0 + r0 ; j < y0 + r1 ; j++){
+                color* row = pixels + j * istride;
+                std::fill(row + x0, row + x1, value);
+            }
+        });
     }
 
     void image::replace(const color& a, const color& b) {
-        for(int i = 0 ; i < iwidth ; i++){
-            for(int j = 0 ; j < iheight ; j++){
-                if(pixels[i][j] == a){
-                    pixels[i][j] = b;
+        trace::span t("image", "image::replace");
+        //cópias: a ou b podem ser pixeis desta imagem (por exemplo img.replace(img.at(x, y), c)),
+        //que uma faixa alteraria enquanto as outras ainda os comparam
+        const color from = a, to = b;
+        detach();
+        int pw = phys_width();
+        parallel::for_rows(phys_height(), pw, [&](int y0, int y1) {
+            spans(pixels, pw, istride, y0, y1, [&](color* p, size_t n) {
+                for(color* end = p + n ; p < end ; p++){
+                    if(*p == from){
+                        *p = to;
+                    }
                 }
-            }
-        }
+            });
+        });
     }
 
     void image::add(const image& img, const color& neutral, int x, int y) {
-        for(int i = x, i2 = 0 ; i < iwidth, i2 < img.iwidth ; i++, i2++){
-            for(int j = y, j2 = 0 ; j < iheight , j2 < img.iheight ; j++, j2++){
-                if(img.at(i2,j2) != neutral){
-                    pixels[i][j] = img.at(i2,j2);
+        add(img.view(), neutral, x, y);
+    }
+
+    void image::add(const image_view& v, const color& neutral, int x, int y) {
+        trace::span t("image", "image::add");
+        //zona de sobreposição, em coordenadas desta imagem
+        int x0, x1, y0, y1;
+        if(!clip(x, v.width(), iwidth, x0, x1) || !clip(y, v.height(), iheight, y0, y1)){
+            return;
+        }
+        //cópia: neutral pode ser um pixel desta imagem, alterado pelas faixas
+        const color skip = neutral;
+        detach();
+        //com rotação pendente cada linha de v é escrita ao longo de (dx, dy) no buffer
+        ptrdiff_t base, dx, dy;
+        steps(base, dx, dy);
+        parallel::for_rows(y1 - y0, x1 - x0, [&](int r0, int r1) {
+            for(int j = y0 + r0 ; j < y0 + r1 ; j++){
+                color* dst = pixels + base + j * dy;
+                const color* src = v.row(j - y) - x;
+                for(int i = x0 ; i < x1 ; i++){
+                    if(src[i] != skip){
+                        dst[i * dx] = src[i];
+                    }
                 }
             }
-        }
+        });
     }
 
     void image::crop(int x, int y, int w, int h) {
-        //processo para copia da matriz anterior e alocação de uma nova
-        color** aux = pixels;
-        pixels = new color*[w];
-        color *data = new color[h*w];
-        for(int i = 0 ; i < w ; i++){
-            pixels[i] = data + i * h;
-            for(int j = 0 ; j < h ; j++){
-                pixels[i][j] = color::WHITE;
-            }
+        trace::span t("image", "image::crop");
+        assert(h > 0 && w > 0);
+        if(x >= 0 && y >= 0 && (long long) x + w <= iwidth && (long long) y + h <= iheight){
+            //o retângulo está dentro da imagem: basta mudar a janela sobre o buffer
+            int x0 = x, x1 = x + w, y0 = y, y1 = y + h;
+            to_physical(x0, x1, y0, y1);
+            pixels += y0 * istride + x0;
+            iwidth = w;
+            iheight = h;
+            return;
         }
-        //processo de preenchimento da nova matriz
-        for(int i = x, i2 = 0  ; i < iwidth && i2 < w ; i++, i2++){
-            for(int j = y, j2 = 0 ; j < iheight && j2 < h ; j++, j2++){
-                pixels[i2][j2] = aux[i][j];
-            }
+        //caso contrário, nova imagem branca com a parte do retângulo que existe
+        image result(w, h);
+        int x0, x1, y0, y1;
+        if(clip(x, w, iwidth, x0, x1) && clip(y, h, iheight, y0, y1)){
+            image_view part = view(x0, y0, x1 - x0, y1 - y0);
+            color* dst = result.pixels + (size_t) (y0 - y) * w + (x0 - x);
+            parallel::for_rows(part.height(), part.width(), [&](int r0, int r1) {
+                for(int r = r0 ; r < r1 ; r++){
+                    std::copy(part.row(r), part.row(r) + part.width(), dst + (size_t) r * w);
+                }
+            });
         }
-        delete [] aux[0];
-        delete [] aux;
-        iwidth = w;
-        iheight = h;
+        *this = result;
     }
 
     void image::rotate_right(){
-        //criação e inicialização de aux
-        int auxheight = iwidth;
-        int auxwidth = iheight;
-        color** aux = new color*[auxwidth];
-        color *data = new color[auxheight*auxwidth];
-        for(int i = 0 ; i < auxwidth ; i++){
-            aux[i] = data + i * auxheight;
-            for(int j = 0 ; j < auxheight ; j++){
-                aux[i][j] = color::WHITE;
-                //não alterei aqui os valores porque para mim ficava mais explicito fazer como fiz no próximo passo
-            }
-        }
-        //resultado da rotação de pixels fica em aux
-        for(int i = 0 ; i < iwidth ; i++){
-            for (int j = 0; j < iheight; j++){
-                aux[iheight-j-1][i] = pixels[i][j];
-            }
-        }
-        //criação e inicialização da nova matriz principal
-        delete [] pixels[0];
-        delete [] pixels;
-        iwidth = auxwidth;
-        iheight = auxheight;
-        pixels = new color*[iwidth];
-        color *data2 = new color[iheight*iwidth];
-        for(int i = 0 ; i < iwidth ; i++){
-            pixels[i] = data2 + i * iheight;
-            for(int j = 0 ; j < iheight ; j++){
-                pixels[i][j] = aux[i][j];
-            }
-        }
-        //eliminação do espaço alocado para aux
-        delete [] aux[0];
-        delete [] aux;
+        trace::span t("image", "image::rotate_right");
+        orientation = (orientation + 1) % 4;
+        std::swap(iwidth, iheight);
     }
 
     void image::rotate_left(){
-        //criação e inicialização de aux
-        int auxheight = iwidth;
-        int auxwidth = iheight;
-        color** aux = new color*[auxwidth];
-        color *data = new color[auxheight*auxwidth];
-        for(int i = 0 ; i < auxwidth ; i++){
-            aux[i] = data + i * auxheight;
-            for(int j = 0 ; j < auxheight ; j++){
-                aux[i][j] = color::WHITE;
-                //não alterei aqui os valores porque para mim fica mais explicito fazer como fiz no próximo passo
-            }
-        }
-        //resultado da rotação de pixels fica em aux
-        for(int i = 0 ; i < iwidth ; i++){
-            for (int j = 0; j < iheight; j++){
-                aux[j][iwidth-i-1] = pixels[i][j];
-            }
-        }
-        //criação e inicialização da nova matriz principal
-        delete [] pixels[0];
-        delete [] pixels;
-        iwidth = auxwidth;
-        iheight = auxheight;
-        pixels = new color*[iwidth];
-        color *data2 = new color[iheight*iwidth];
-        for(int i = 0 ; i < iwidth ; i++){
-            pixels[i] = data2 + i * iheight;
-            for(int j = 0 ; j < iheight ; j++){
-                pixels[i][j] = aux[i][j];
-            }
-        }
-        //eliminação do espaço alocado para aux
-        delete [] aux[0];
-        delete [] aux;
+        trace::span t("image", "image::rotate_left");
+        orientation = (orientation + 3) % 4;
+        std::swap(iwidth, iheight);
     }
 
     void image::mix(const image& img, int factor) {
-        for(int i = 0 ; i < iwidth ; i++){
-            for(int j = 0 ; j < iheight ; j++){
-                pixels[i][j].mix(img.at(i,j),factor);
+        mix(img.view(), factor);
+    }
+
+    void image::mix(const image_view& v, int factor) {
+        trace::span t("image", "image::mix");
+        //só a zona comum às duas imagens é misturada
+        int w = std::min(iwidth, v.width());
+        int h = std::min(iheight, v.height());
+        materialize();
+        detach();
+        parallel::for_rows(h, w, [&](int y0, int y1) {
+            for(int j = y0 ; j < y1 ; j++){
+                kernels::mix(pixels + j * istride, v.row(j), w, factor);
             }
-        }
+        });
     }
 }
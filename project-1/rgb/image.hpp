@@ -2,29 +2,166 @@
 #ifndef __rgb_image_hpp__
 #define __rgb_image_hpp__
 #include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
 #include <rgb/color.hpp>
+#include <rgb/image_view.hpp>
+#include <rgb/pipeline.hpp>
+#include <rgb/pixel_op.hpp>
+#include <vector>
 
 namespace rgb {
     class image {
     private:
         //! Campo para guardar a largura da imagem
+        //!
+        //! é a largura vista de fora, já com a orientação aplicada
         int iwidth;
         //! Campo para guardar a altura da imagem
+        //!
+        //! é a altura vista de fora, já com a orientação aplicada
         int iheight;
-        //! Campo para guardar os pixeis da imagem
+        //! Campo para guardar o buffer onde estão os pixeis
+        //!
+        //! pode ser partilhado com vistas (rgb::image_view) ou com outras imagens;
+        //! antes de alterar pixeis a imagem passa a ter um buffer só seu (detach())
+        std::shared_ptr<color> buffer;
+        //! Campo para guardar o pixel (0,0) da imagem, dentro de buffer
+        //!
+        //! os pixeis estão guardados linha a linha, no mesmo formato RGB intercalado
+        //! que é usado pelo stb: o pixel (x,y) está em pixels[y * stride + x]
+        color *pixels;
+        //! Campo para guardar a distância, em pixeis, entre linhas consecutivas
+        //!
+        //! é maior que a largura quando a imagem é um recorte de uma imagem maior
+        ptrdiff_t istride;
+        //! Campo para guardar a orientação da imagem (número de rotações de 90º para a direita, 0 a 3)
+        //!
+        //! rotate_left() e rotate_right() só mudam este campo; os pixeis só são
+        //! movidos (materialize()) quando for mesmo preciso ter a imagem direita
+        //! em memória. Com orientação diferente de 0 o buffer guarda a imagem
+        //! original, com phys_width() x phys_height() pixeis
+        int orientation;
+        //! Obtem a largura dos pixeis tal como estão no buffer
+        //!
+        //! \return iwidth ou iheight, conforme a orientação
+        int phys_width() const;
+        //! Obtem a altura dos pixeis tal como estão no buffer
+        //!
+        //! \return iheight ou iwidth, conforme a orientação
+        int phys_height() const;
+        //! Obtem a posição no buffer do pixel (x,y): pixels[base + x * dx + y * dy]
+        //!
+        //! \param base posição do pixel (0,0), relativa a pixels
+        //! \param dx distância entre (x,y) e (x+1,y)
+        //! \param dy distância entre (x,y) e (x,y+1)
+        void steps(ptrdiff_t& base, ptrdiff_t& dx, ptrdiff_t& dy) const;
+        //! Converte um retângulo [x0,x1) x [y0,y1) para coordenadas do buffer
+        //!
+        //! \param x0 primeira coluna
+        //! \param x1 coluna a seguir à última
+        //! \param y0 primeira linha
+        //! \param y1 linha a seguir à última
+        void to_physical(int& x0, int& x1, int& y0, int& y1) const;
+        //! Função para mover os pixeis de acordo com a orientação, que passa a ser 0
+        //!
+        //! é usada antes das operações que precisam da imagem direita em memória
+        void materialize();
+        //! Função para garantir que o buffer não é partilhado antes de o alterar
+        //!
+        //! se for partilhado, copia os pixeis da imagem para um buffer novo
+        void detach();
+        //! Aplica f(primeiro pixel, número de pixeis) a todos os pixeis do buffer, em paralelo
         //!
-        //! matriz de cores implementada como array de apontadores
-        color **pixels;
+        //! garante antes um buffer só da imagem (detach()); serve as operações por pixel,
+        //! que não dependem da orientação
+        //! \param f função chamada para cada sequência de pixeis consecutivos
+        void for_each_span(const std::function<void(color*, size_t)>& f);
     public:
+        //! Construtor de imagem vazia (0 x 0, sem buffer)
+        //!
+        //! é também o estado de uma imagem depois de movida; só pode ser
+        //! consultada (width(), height(), empty()), atribuída ou destruída
+        image();
         //! Construtor de imagem
         //!
         //! \param w largura
         //! \param h altura
         //! \param fill cor inical para todos os pixeis (por defeito é a cor branca)
         image(int w, int h, const color& fill = color::WHITE);
+        //! Reserva um buffer para n pixeis, sem os inicializar
+        //!
+        //! serve para os descodificadores escreverem os pixeis diretamente no
+        //! buffer que depois é entregue ao construtor image(int, int, std::shared_ptr<color>)
+        //! \param n número de pixeis
+        //! \return buffer partilhado
+        static std::shared_ptr<color> allocate(size_t n);
+        //! Passa a guardar os pixeis das imagens grandes em ficheiros temporários
+        //!
+        //! os buffers com pelo menos min_bytes bytes são mapeados de um ficheiro em dir
+        //! (apagado logo que é criado) em vez de reservados no heap: o sistema operativo
+        //! só mantém em memória as páginas em uso e guarda as outras no ficheiro, por
+        //! isso as imagens podem ser maiores que a memória disponível. As operações
+        //! percorrem a imagem por bandas de linhas (e as rotações por blocos), o que
+        //! mantém poucas páginas em uso de cada vez. Deve ser chamada antes de criar imagens.
+        //! Os ficheiros QOI, PPM e PAM são descodificados para estes buffers; os PNG e JPEG
+        //! completos são descodificados pelo stb no heap (malloc), por isso ficam fora dos
+        //! ficheiros temporários e limitados pelo stb a cerca de 715 megapixeis
+        //! \param dir diretoria para os ficheiros (vazia para voltar a usar só o heap)
+        //! \param min_bytes tamanho mínimo dos buffers guardados em ficheiro
+        static void use_scratch(const std::string& dir, size_t min_bytes);
+        //! Construtor de imagem a partir de um buffer já preenchido
+        //!
+        //! não copia nem inicializa pixeis: a imagem fica dona do buffer, que é
+        //! libertado pelo deleter do shared_ptr (por exemplo, o do descodificador)
+        //! \param w largura
+        //! \param h altura
+        //! \param pixels buffer com w*h pixeis, linha a linha
+        image(int w, int h, std::shared_ptr<color> pixels);
+        //! Construtor de imagem a partir de uma vista
+        //!
+        //! não copia pixeis: a imagem partilha o buffer da vista e só o copia
+        //! se for alterada enquanto o buffer estiver partilhado
+        //! \param v vista a adotar
+        explicit image(const image_view& v);
+        //! Construtor de cópia
+        //!
+        //! não copia pixeis: as duas imagens partilham o buffer até uma delas ser
+        //! alterada (para uma cópia independente logo à partida, usar clone())
+        //! \param other imagem a copiar
+        image(const image& other) = default;
+        //! Construtor por movimento
+        //!
+        //! fica com o buffer de other, que passa a ser uma imagem vazia
+        //! \param other imagem a mover
+        image(image&& other) noexcept;
+        //! Atribuição por cópia (partilha o buffer, como o construtor de cópia)
+        //!
+        //! \param other imagem a copiar
+        //! \return esta imagem
+        image& operator=(const image& other) = default;
+        //! Atribuição por movimento
+        //!
+        //! liberta o buffer desta imagem (se não estiver partilhado) e fica com o
+        //! de other, que passa a ser uma imagem vazia
+        //! \param other imagem a mover
+        //! \return esta imagem
+        image& operator=(image&& other) noexcept;
+        //! Cria uma cópia com um buffer só seu
+        //!
+        //! os pixeis são copiados já com as rotações pendentes aplicadas
+        //! \return imagem independente desta
+        image clone() const;
+        //! Troca o conteúdo (buffer, dimensões e orientação) com outra imagem
+        //!
+        //! não copia pixeis
+        //! \param other imagem com que trocar
+        void swap(image& other) noexcept;
         //! Destrutor de imagem
         //!
-        //! liberta o espaço alocado para a matriz de pixeis
+        //! liberta o buffer de pixeis, se não estiver partilhado
         ~image();
         //! Obtem a largura da imagem
         //!
@@ -34,6 +171,10 @@ namespace rgb {
         //!
         //! \return iheight
         int height() const;
+        //! Verifica se a imagem é vazia (construída sem dimensões, ou movida)
+        //!
+        //! \return true se não tiver pixeis
+        bool empty() const;
         //! Obtem cor do pixel na posição (x,y)
         //!
         //! \param x componente x da posição
@@ -46,12 +187,60 @@ namespace rgb {
         //! \param y componente y da posição
         //! \return referência constante para a cor do pixel
         const color& at(int x, int y) const;
+        //! Obtem o buffer de pixeis da imagem
+        //!
+        //! aplica primeiro as rotações pendentes
+        //! \return apontador para o primeiro pixel; a linha y começa em data() + y * stride()
+        color* data();
+        //! Obtem o buffer (constante) de pixeis da imagem
+        //!
+        //! só pode ser usada se não houver rotações pendentes (is_upright())
+        //! \return apontador constante para o primeiro pixel; a linha y começa em data() + y * stride()
+        const color* data() const;
+        //! Obtem a distância entre linhas consecutivas
+        //!
+        //! só tem significado se não houver rotações pendentes (is_upright())
+        //! \return istride (em pixeis)
+        ptrdiff_t stride() const;
+        //! Verifica se os pixeis estão em memória pela ordem da imagem
+        //!
+        //! \return false se houver rotações ainda não aplicadas ao buffer
+        bool is_upright() const;
+        //! Obtem uma vista sobre todos os pixeis da imagem
+        //!
+        //! se houver rotações pendentes a vista é sobre uma cópia já rodada
+        //! \return vista que partilha o buffer da imagem
+        image_view view() const;
+        //! Obtem uma vista sobre uma zona da imagem
+        //!
+        //! o retângulo tem de estar dentro da imagem; se houver rotações pendentes
+        //! a vista é sobre uma cópia já rodada dessa zona
+        //! \param x componente x do topo superior esquerdo
+        //! \param y componente y do topo superior esquerdo
+        //! \param w largura
+        //! \param h altura
+        //! \return vista que partilha o buffer da imagem
+        image_view view(int x, int y, int w, int h) const;
         //! Função para inverter todos os pixeis da imagem
         //!
         //! utiliza a função color::invert()
         void invert();
         //! Função para converter todos os pixeis para uma escala de cinzento
         void to_gray_scale();
+        //! Função para aplicar várias operações por pixel numa só passagem
+        //!
+        //! percorre a imagem por blocos pequenos e aplica-lhes as operações por ordem,
+        //! com o mesmo resultado que chamar as funções correspondentes uma a uma
+        //! \param ops operações a aplicar
+        void apply(const std::vector<pixel_op>& ops);
+        //! Função para aplicar uma cadeia de operações (rgb::pipeline) numa só passagem
+        //!
+        //! a cadeia é um só tipo, por isso o compilador junta as operações num único
+        //! ciclo: cada pixel é lido e escrito uma vez, com o mesmo resultado que
+        //! chamar as funções correspondentes uma a uma
+        //! \param ops operações a aplicar, por exemplo pipeline::invert() | pipeline::to_gray_scale()
+        template <class S>
+        void apply(const pipeline::stage<S>& ops);
         //! Função para alterar a cor de pixeis com uma certa cor
         //!
         //! \param a cor a substituir
@@ -72,17 +261,30 @@ namespace rgb {
         //! \param img imagem a misturar
         //! \param factor fator a misturar
         void mix(const image& img, int factor);
+        //! Função para alterar a imagem misturando-a com uma vista
+        //!
+        //! igual a mix(const image&, int), mas sem precisar de uma imagem completa
+        //! \param v vista a misturar
+        //! \param factor fator a misturar
+        void mix(const image_view& v, int factor);
         //! Função para reduzir a imagem
         //!
-        //! reduz a dimensão ao retângulo com início (x,y) e dimensão w * h
+        //! reduz a dimensão ao retângulo com início (x,y) e dimensão w * h;
+        //! se o retângulo estiver dentro da imagem não copia pixeis (a imagem passa
+        //! a ser uma janela sobre o mesmo buffer), caso contrário a parte de fora fica branca
         //! \param x componente x do topo superior esquerdo
         //! \param y componente y do topo superior esquerdo
         //! \param w largura
         //! \param h altura
         void crop(int x, int y, int w, int h);
         //! Função para rodar a imagem para a esquerda
+        //!
+        //! só muda a orientação: at(), fill(), crop() e add() passam a converter as
+        //! coordenadas e os pixeis só são movidos quando for preciso
         void rotate_left();
         //! Função para rodar a imagem para a direita
+        //!
+        //! só muda a orientação, tal como rotate_left()
         void rotate_right();
         //! Função para adicionar o conteúdo de img à imagem
         //!
@@ -92,7 +294,33 @@ namespace rgb {
         //! \param x componente x da posição inicial
         //! \param y componente y do posição inicial
         void add(const image& img, const color& neutral, int x, int y);
+        //! Função para adicionar o conteúdo de uma vista à imagem
+        //!
+        //! igual a add(const image&, const color&, int, int), mas sem precisar de uma imagem completa
+        //! \param v vista a adicionar
+        //! \param neutral cor para conparação
+        //! \param x componente x da posição inicial
+        //! \param y componente y do posição inicial
+        void add(const image_view& v, const color& neutral, int x, int y);
     };
+
+    template <class S>
+    void image::apply(const pipeline::stage<S>& ops) {
+        const S& op = ops.self();
+        for_each_span([&op](color* p, size_t n) {
+            for(color* end = p + n ; p < end ; p++){
+                op(*p);
+            }
+        });
+    }
+
+    //! Troca o conteúdo de duas imagens, sem copiar pixeis (ver image::swap())
+    //!
+    //! \param a primeira imagem
+    //! \param b segunda imagem
+    inline void swap(image& a, image& b) noexcept {
+        a.swap(b);
+    }
 }
 
 
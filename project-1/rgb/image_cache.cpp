@@ -0,0 +1,175 @@
+#include <future>
+#include <sys/stat.h>
+
+#include <rgb/image_cache.hpp>
+#include <rgb/pixel_pool.hpp>
+#include <png/png.hpp>
+
+namespace rgb {
+    namespace {
+        //! Identifica a versão de um ficheiro pela data de modificação e pelo tamanho
+        //!
+        //! \return false se o ficheiro não existir
+        bool file_stamp(const std::string& file, long long& mtime, long long& size) {
+            struct stat st;
+            if (stat(file.c_str(), &st) != 0) {
+                return false;
+            }
+#if defined(__APPLE__)
+            mtime = (long long) st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+            mtime = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+            mtime = (long long) st.st_mtime * 1000000000LL;
+#endif
+            size = (long long) st.st_size;
+            return true;
+        }
+    }
+
+    image_cache::image_cache(size_t budget) :
+            limit(budget), bytes_used(0), nhits(0), nmisses(0), charged(std::make_shared<memory::account>()) {}
+
+    image_cache& image_cache::shared() {
+        static image_cache cache;
+        return cache;
+    }
+
+    std::shared_ptr<const image> image_cache::load(const std::string& file, int scale) {
+        long long mtime, size;
+        if (!file_stamp(file, mtime, size)) {
+            return std::shared_ptr<const image>();
+        }
+        // cada redução de um ficheiro é uma entrada diferente
+        const std::string key = scale > 1 ? file + " 1/" + std::to_string(scale) : file;
+        std::promise<std::shared_ptr<const image> > decoded;
+        bool keep;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            keep = limit != 0;
+            std::map<std::string, entry>::iterator it = entries.find(key);
+            if (it != entries.end()) {
+                if (it->second.mtime == mtime && it->second.size == size) {
+                    nhits++;
+                    order.splice(order.begin(), order, it->second.lru);
+                    return it->second.img;
+                }
+                // o ficheiro mudou desde que foi lido
+                erase(it);
+            }
+            std::map<std::string, pending>::iterator p = loading.find(key);
+            if (p != loading.end() && p->second.mtime == mtime && p->second.size == size) {
+                // outra thread já está a descodificar o mesmo ficheiro: espera por ela
+                nhits++;
+                std::shared_future<std::shared_ptr<const image> > result = p->second.result;
+                lock.unlock();
+                return result.get();
+            }
+            nmisses++;
+            pending& started = loading[key];
+            started.result = decoded.get_future().share();
+            started.mtime = mtime;
+            started.size = size;
+        }
+
+        // (com o lock) deixa de a marcar como em curso, se for ainda a mesma versão do ficheiro
+        auto finished = [&]() {
+            std::map<std::string, pending>::iterator p = loading.find(key);
+            if (p != loading.end() && p->second.mtime == mtime && p->second.size == size) {
+                loading.erase(p);
+            }
+        };
+
+        // a descodificação é feita sem o lock para não bloquear os outros pedidos;
+        // a imagem é descodificada diretamente para o objeto partilhado
+        std::shared_ptr<image> decoding = std::make_shared<image>();
+        try {
+            // a imagem pode ficar na cache depois de o script que a pediu acabar,
+            // por isso não usa a conta nem a reserva de buffers desse script
+            memory::scope in(keep ? charged : memory::current());
+            pixel_pool::scope from(keep ? std::shared_ptr<pixel_pool>() : pixel_pool::current());
+            if (!png::load(file, scale, *decoding)) {
+                decoding.reset();
+            }
+        } catch (...) {
+            // sem memória (memory::account::set_budget()): quem espera recebe o mesmo erro
+            decoded.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(m);
+            finished();
+            throw;
+        }
+        std::shared_ptr<const image> img = decoding;
+        decoded.set_value(img);
+
+        std::lock_guard<std::mutex> lock(m);
+        finished();
+        if (!img) {
+            return img;
+        }
+        size_t bytes = (size_t) img->width() * img->height() * sizeof(color);
+        if (bytes > limit || entries.count(key) != 0) {
+            return img;
+        }
+        evict(bytes);
+        order.push_front(key);
+        entry e;
+        e.img = img;
+        e.mtime = mtime;
+        e.size = size;
+        e.bytes = bytes;
+        e.lru = order.begin();
+        entries[key] = e;
+        bytes_used += bytes;
+        return img;
+    }
+
+    void image_cache::evict(size_t bytes) {
+        while (!order.empty() && bytes_used + bytes > limit) {
+            erase(entries.find(order.back()));
+        }
+    }
+
+    void image_cache::erase(std::map<std::string, entry>::iterator it) {
+        // quem ainda usa a imagem mantém-na viva através do shared_ptr
+        bytes_used -= it->second.bytes;
+        order.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    void image_cache::set_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(m);
+        limit = bytes;
+        evict(0);
+    }
+
+    size_t image_cache::budget() const {
+        std::lock_guard<std::mutex> lock(m);
+        return limit;
+    }
+
+    size_t image_cache::used() const {
+        std::lock_guard<std::mutex> lock(m);
+        return bytes_used;
+    }
+
+    size_t image_cache::hits() const {
+        std::lock_guard<std::mutex> lock(m);
+        return nhits;
+    }
+
+    size_t image_cache::misses() const {
+        std::lock_guard<std::mutex> lock(m);
+        return nmisses;
+    }
+
+    const memory::account& image_cache::memory_usage() const {
+        return *charged;
+    }
+
+    void image_cache::clear() {
+        std::lock_guard<std::mutex> lock(m);
+        entries.clear();
+        order.clear();
+        bytes_used = 0;
+    }
+}
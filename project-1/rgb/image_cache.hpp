@@ -0,0 +1,122 @@
+//! @file image_cache.hpp
+#ifndef __rgb_image_cache_hpp__
+#define __rgb_image_cache_hpp__
+
+#include <cstddef>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <rgb/image.hpp>
+#include <rgb/memory.hpp>
+
+namespace rgb {
+    //! Cache de imagens já descodificadas, indexada pelo caminho do ficheiro
+    //!
+    //! uma entrada só é reutilizada se o ficheiro não tiver mudado (mesma data de
+    //! modificação e mesmo tamanho); quando o total de pixeis guardados passa o
+    //! orçamento, saem as imagens usadas há mais tempo (LRU). As imagens devolvidas
+    //! são partilhadas e só de leitura: para as alterar cria-se uma rgb::image a
+    //! partir de view(), que só copia os pixeis quando os altera. Pode ser usada
+    //! por várias threads; se várias pedem o mesmo ficheiro ao mesmo tempo, só
+    //! uma o descodifica. Os buffers das imagens descodificadas são da conta de
+    //! memória da cache (memory_usage()) e não da do script que as pediu primeiro
+    class image_cache {
+    public:
+        //! Orçamento por omissão, em bytes de pixeis
+        static const size_t DEFAULT_BUDGET = 256u << 20;
+        //! Construtor de uma cache
+        //!
+        //! \param budget número máximo de bytes de pixeis guardados
+        explicit image_cache(size_t budget = DEFAULT_BUDGET);
+        //! Obtem a cache partilhada pelos scripts
+        //!
+        //! \return referência para a cache global
+        static image_cache& shared();
+        //! Obtem uma imagem, descodificando o ficheiro só se for preciso
+        //!
+        //! \param file nome do ficheiro
+        //! \param scale fator de redução (1, 2, 4 ou 8), ver png::load(const std::string&, int)
+        //! \return imagem partilhada, ou NULL se o ficheiro não puder ser lido
+        std::shared_ptr<const image> load(const std::string& file, int scale = 1);
+        //! Altera o orçamento, retirando imagens se for preciso
+        //!
+        //! \param bytes número máximo de bytes de pixeis guardados (0 desliga a cache)
+        void set_budget(size_t bytes);
+        //! Obtem o orçamento
+        //!
+        //! \return número máximo de bytes de pixeis guardados
+        size_t budget() const;
+        //! Obtem o número de bytes de pixeis guardados
+        //!
+        //! \return bytes em uso
+        size_t used() const;
+        //! Obtem o número de pedidos servidos sem descodificar
+        //!
+        //! \return número de acertos
+        size_t hits() const;
+        //! Obtem o número de pedidos que obrigaram a descodificar
+        //!
+        //! \return número de falhas
+        size_t misses() const;
+        //! Obtem a conta de memória das imagens descodificadas pela cache
+        //!
+        //! com a cache desligada (orçamento 0) as imagens são da conta de quem as pede
+        //! \return bytes vivos, pico e número de reservas
+        const memory::account& memory_usage() const;
+        //! Retira todas as imagens da cache
+        void clear();
+    private:
+        //! Imagem guardada e a identificação do ficheiro de onde veio
+        struct entry {
+            //! Campo para guardar a imagem
+            std::shared_ptr<const image> img;
+            //! Campo para guardar a data de modificação do ficheiro (em nanossegundos)
+            long long mtime;
+            //! Campo para guardar o tamanho do ficheiro
+            long long size;
+            //! Campo para guardar o número de bytes de pixeis da imagem
+            size_t bytes;
+            //! Campo para guardar a posição na lista LRU
+            std::list<std::string>::iterator lru;
+        };
+        //! Descodificação em curso de um ficheiro
+        struct pending {
+            //! Campo para guardar o resultado, partilhado por quem espera por ele
+            std::shared_future<std::shared_ptr<const image> > result;
+            //! Campo para guardar a data de modificação do ficheiro (em nanossegundos)
+            long long mtime;
+            //! Campo para guardar o tamanho do ficheiro
+            long long size;
+        };
+        //! Função para retirar imagens até caberem mais bytes no orçamento
+        //!
+        //! \param bytes bytes que se pretende acrescentar
+        void evict(size_t bytes);
+        //! Função para retirar uma entrada
+        //!
+        //! \param it entrada a retirar
+        void erase(std::map<std::string, entry>::iterator it);
+        //! Campo para proteger a cache quando usada por várias threads
+        mutable std::mutex m;
+        //! Campo para guardar as entradas, indexadas pelo ficheiro e pela redução
+        std::map<std::string, entry> entries;
+        //! Campo para guardar as descodificações em curso
+        std::map<std::string, pending> loading;
+        //! Campo para guardar as chaves (ficheiro e redução), da mais para a menos usada
+        std::list<std::string> order;
+        //! Campo para guardar o orçamento
+        size_t limit;
+        //! Campo para guardar os bytes em uso
+        size_t bytes_used;
+        //! Campo para guardar o número de acertos
+        size_t nhits;
+        //! Campo para guardar o número de falhas
+        size_t nmisses;
+        //! Campo para guardar a conta de memória das imagens descodificadas
+        std::shared_ptr<memory::account> charged;
+    };
+}
+#endif
@@ -0,0 +1,38 @@
+#include <cassert>
+#include <rgb/image_view.hpp>
+
+namespace rgb {
+    image_view::image_view(std::shared_ptr<const color> buffer, const color* origin, int w, int h, ptrdiff_t stride) :
+            buffer(buffer), origin(origin), vwidth(w), vheight(h), vstride(stride) {
+        assert(w > 0 && h > 0 && stride >= w);
+    }
+
+    int image_view::width() const {
+        return vwidth;
+    }
+
+    int image_view::height() const {
+        return vheight;
+    }
+
+    ptrdiff_t image_view::stride() const {
+        return vstride;
+    }
+
+    const color& image_view::at(int x, int y) const {
+        return origin[y * vstride + x];
+    }
+
+    const color* image_view::row(int y) const {
+        return origin + y * vstride;
+    }
+
+    image_view image_view::sub(int x, int y, int w, int h) const {
+        assert(x >= 0 && y >= 0 && x + w <= vwidth && y + h <= vheight);
+        return image_view(buffer, origin + y * vstride + x, w, h, vstride);
+    }
+
+    const std::shared_ptr<const color>& image_view::shared_buffer() const {
+        return buffer;
+    }
+}
@@ -0,0 +1,74 @@
+//! @file image_view.hpp
+#ifndef __rgb_image_view_hpp__
+#define __rgb_image_view_hpp__
+
+#include <cstddef>
+#include <memory>
+#include <rgb/color.hpp>
+
+namespace rgb {
+    //! Vista (só de leitura) sobre uma zona retangular dos pixeis de uma imagem
+    //!
+    //! não copia pixeis: guarda o buffer partilhado, o pixel de origem, as dimensões
+    //! e a distância entre linhas; enquanto a vista existir o buffer não é libertado
+    //! e a imagem de onde veio copia os pixeis antes de os alterar
+    class image_view {
+    private:
+        //! Campo para guardar o buffer partilhado onde estão os pixeis
+        std::shared_ptr<const color> buffer;
+        //! Campo para guardar o pixel (0,0) da vista
+        const color* origin;
+        //! Campo para guardar a largura da vista
+        int vwidth;
+        //! Campo para guardar a altura da vista
+        int vheight;
+        //! Campo para guardar a distância, em pixeis, entre linhas consecutivas
+        ptrdiff_t vstride;
+    public:
+        //! Construtor de uma vista
+        //!
+        //! \param buffer buffer partilhado com os pixeis
+        //! \param origin pixel (0,0) da vista, dentro de buffer
+        //! \param w largura
+        //! \param h altura
+        //! \param stride distância entre linhas, em pixeis
+        image_view(std::shared_ptr<const color> buffer, const color* origin, int w, int h, ptrdiff_t stride);
+        //! Obtem a largura da vista
+        //!
+        //! \return vwidth
+        int width() const;
+        //! Obtem a altura da vista
+        //!
+        //! \return vheight
+        int height() const;
+        //! Obtem a distância entre linhas
+        //!
+        //! \return vstride
+        ptrdiff_t stride() const;
+        //! Obtem cor do pixel na posição (x,y)
+        //!
+        //! \param x componente x da posição
+        //! \param y componente y da posição
+        //! \return referência constante para a cor do pixel
+        const color& at(int x, int y) const;
+        //! Obtem o primeiro pixel de uma linha
+        //!
+        //! \param y linha
+        //! \return apontador para o pixel (0,y); os pixeis da linha são consecutivos
+        const color* row(int y) const;
+        //! Obtem uma vista sobre uma zona desta vista
+        //!
+        //! o retângulo tem de estar dentro da vista
+        //! \param x componente x do topo superior esquerdo
+        //! \param y componente y do topo superior esquerdo
+        //! \param w largura
+        //! \param h altura
+        //! \return nova vista sobre o mesmo buffer
+        image_view sub(int x, int y, int w, int h) const;
+        //! Obtem o buffer partilhado
+        //!
+        //! \return buffer
+        const std::shared_ptr<const color>& shared_buffer() const;
+    };
+}
+#endif
@@ -0,0 +1,314 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <rgb/kernels.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RGB_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace rgb {
+    namespace kernels {
+        namespace {
+            // Divisões exatas sem instrução de divisão (verificadas para todo o domínio):
+            // x / 100 == (x * 41944) >> 22 para 0 <= x <= 25500
+            // x / 3   == (x * 43691) >> 17 para 0 <= x <= 765
+            const int DIV100_MUL = 41944;
+            const int DIV100_SHIFT = 22 - 16;
+            const int DIV3_MUL = 43691;
+            const int DIV3_SHIFT = 17 - 16;
+
+            // Versões escalares SWAR: 8 componentes por palavra de 64 bits.
+            // Nos produtos, cada componente ocupa uma lane de 16 bits (bytes pares
+            // e ímpares em separado) e a divisão por 100 usa lanes de 32 bits:
+            // x / 100 == (x * 5243) >> 19 para 0 <= x <= 25500
+            const uint64_t EVEN_BYTES = 0x00FF00FF00FF00FFull;
+            const uint64_t EVEN_HALVES = 0x0000FFFF0000FFFFull;
+            const uint64_t DIV100_SWAR_MUL = 5243;
+            const int DIV100_SWAR_SHIFT = 19;
+
+            void invert_scalar(color* p, size_t n) {
+                rgb_value* b = reinterpret_cast<rgb_value*>(p);
+                size_t bytes = n * 3, i = 0;
+                for( ; i + 8 <= bytes ; i += 8){
+                    uint64_t w;
+                    memcpy(&w, b + i, 8);
+                    w = ~w;
+                    memcpy(b + i, &w, 8);
+                }
+                for( ; i < bytes ; i++){
+                    b[i] = 255 - b[i];
+                }
+            }
+
+            void gray_scalar(color* p, size_t n) {
+                for(size_t i = 0 ; i < n ; i++){
+                    p[i].to_gray_scale();
+                }
+            }
+
+            // color::mix() aplica a mesma fórmula às três componentes,
+            // por isso os kernels de mistura trabalham byte a byte
+            void mix_scalar(rgb_value* a, const rgb_value* b, size_t bytes, int f) {
+                for(size_t i = 0 ; i < bytes ; i++){
+                    a[i] = (((100 - f) * a[i]) + (f * b[i])) / 100;
+                }
+            }
+
+            // Divide por 100 as quatro lanes de 16 bits de s (cada uma até 25500)
+            inline uint64_t div100_swar(uint64_t s) {
+                uint64_t even = (s & EVEN_HALVES) * DIV100_SWAR_MUL;
+                uint64_t odd = ((s >> 16) & EVEN_HALVES) * DIV100_SWAR_MUL;
+                return ((even >> DIV100_SWAR_SHIFT) & 0xFF) | ((even >> (32 + DIV100_SWAR_SHIFT)) & 0xFF) << 32 |
+                       ((odd >> DIV100_SWAR_SHIFT) & 0xFF) << 16 | ((odd >> (32 + DIV100_SWAR_SHIFT)) & 0xFF) << 48;
+            }
+
+            // Só para 0 <= f <= 100: as somas (a * (100 - f) + b * f) cabem nas lanes de 16 bits
+            void mix_swar(rgb_value* a, const rgb_value* b, size_t bytes, int f) {
+                size_t i = 0;
+                const uint64_t fa = 100 - f, fb = f;
+                for( ; i + 8 <= bytes ; i += 8){
+                    uint64_t va, vb;
+                    memcpy(&va, a + i, 8);
+                    memcpy(&vb, b + i, 8);
+                    uint64_t even = div100_swar((va & EVEN_BYTES) * fa + (vb & EVEN_BYTES) * fb);
+                    uint64_t odd = div100_swar(((va >> 8) & EVEN_BYTES) * fa + ((vb >> 8) & EVEN_BYTES) * fb);
+                    uint64_t w = even | odd << 8;
+                    memcpy(a + i, &w, 8);
+                }
+                mix_scalar(a + i, b + i, bytes - i, f);
+            }
+
+#ifdef RGB_X86_KERNELS
+            __attribute__((target("sse2")))
+            void invert_sse2(color* p, size_t n) {
+                rgb_value* b = reinterpret_cast<rgb_value*>(p);
+                size_t bytes = n * 3, i = 0;
+                const __m128i ones = _mm_set1_epi8((char) 0xFF);
+                for( ; i + 16 <= bytes ; i += 16){
+                    __m128i v = _mm_loadu_si128((const __m128i*) (b + i));
+                    _mm_storeu_si128((__m128i*) (b + i), _mm_xor_si128(v, ones));
+                }
+                for( ; i < bytes ; i++){
+                    b[i] = 255 - b[i];
+                }
+            }
+
+            __attribute__((target("avx2")))
+            void invert_avx2(color* p, size_t n) {
+                rgb_value* b = reinterpret_cast<rgb_value*>(p);
+                size_t bytes = n * 3, i = 0;
+                const __m256i ones = _mm256_set1_epi8((char) 0xFF);
+                for( ; i + 32 <= bytes ; i += 32){
+                    __m256i v = _mm256_loadu_si256((const __m256i*) (b + i));
+                    _mm256_storeu_si256((__m256i*) (b + i), _mm256_xor_si256(v, ones));
+                }
+                for( ; i < bytes ; i++){
+                    b[i] = 255 - b[i];
+                }
+            }
+
+            // Mistura de 8 componentes em 16 bits: (a * (100 - f) + b * f) / 100
+            __attribute__((target("sse2")))
+            inline __m128i mix_lanes_sse2(__m128i a, __m128i b, __m128i fa, __m128i fb) {
+                __m128i s = _mm_add_epi16(_mm_mullo_epi16(a, fa), _mm_mullo_epi16(b, fb));
+                return _mm_srli_epi16(_mm_mulhi_epu16(s, _mm_set1_epi16((short) DIV100_MUL)), DIV100_SHIFT);
+            }
+
+            __attribute__((target("sse2")))
+            void mix_sse2(rgb_value* a, const rgb_value* b, size_t bytes, int f) {
+                size_t i = 0;
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i fa = _mm_set1_epi16((short) (100 - f));
+                const __m128i fb = _mm_set1_epi16((short) f);
+                for( ; i + 16 <= bytes ; i += 16){
+                    __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+                    __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+                    __m128i lo = mix_lanes_sse2(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero), fa, fb);
+                    __m128i hi = mix_lanes_sse2(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero), fa, fb);
+                    _mm_storeu_si128((__m128i*) (a + i), _mm_packus_epi16(lo, hi));
+                }
+                mix_scalar(a + i, b + i, bytes - i, f);
+            }
+
+            __attribute__((target("avx2")))
+            inline __m256i mix_lanes_avx2(__m256i a, __m256i b, __m256i fa, __m256i fb) {
+                __m256i s = _mm256_add_epi16(_mm256_mullo_epi16(a, fa), _mm256_mullo_epi16(b, fb));
+                return _mm256_srli_epi16(_mm256_mulhi_epu16(s, _mm256_set1_epi16((short) DIV100_MUL)), DIV100_SHIFT);
+            }
+
+            __attribute__((target("avx2")))
+            void mix_avx2(rgb_value* a, const rgb_value* b, size_t bytes, int f) {
+                size_t i = 0;
+                const __m256i zero = _mm256_setzero_si256();
+                const __m256i fa = _mm256_set1_epi16((short) (100 - f));
+                const __m256i fb = _mm256_set1_epi16((short) f);
+                for( ; i + 32 <= bytes ; i += 32){
+                    __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+                    __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+                    // unpack/pack trabalham por metades de 128 bits, pelo que a ordem se mantém
+                    __m256i lo = mix_lanes_avx2(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero), fa, fb);
+                    __m256i hi = mix_lanes_avx2(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero), fa, fb);
+                    _mm256_storeu_si256((__m256i*) (a + i), _mm256_packus_epi16(lo, hi));
+                }
+                mix_sse2(a + i, b + i, bytes - i, f);
+            }
+
+            // Máscaras pshufb para separar 16 pixeis (48 bytes) nas três componentes
+            // e para voltar a intercalar 16 valores de cinzento em 48 bytes.
+            struct gray_masks {
+                rgb_value split[3][3][16];
+                rgb_value join[3][16];
+                gray_masks() {
+                    for(int ch = 0 ; ch < 3 ; ch++){
+                        for(int s = 0 ; s < 3 ; s++){
+                            for(int k = 0 ; k < 16 ; k++){
+                                int pos = 3 * k + ch - 16 * s;
+                                split[ch][s][k] = (pos >= 0 && pos < 16) ? pos : 0x80;
+                            }
+                        }
+                    }
+                    for(int s = 0 ; s < 3 ; s++){
+                        for(int j = 0 ; j < 16 ; j++){
+                            join[s][j] = (16 * s + j) / 3;
+                        }
+                    }
+                }
+            };
+
+            __attribute__((target("ssse3")))
+            void gray_ssse3(color* p, size_t n) {
+                static const gray_masks masks;
+                rgb_value* b = reinterpret_cast<rgb_value*>(p);
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i div3 = _mm_set1_epi16((short) DIV3_MUL);
+                __m128i split[3][3], join[3];
+                for(int s = 0 ; s < 3 ; s++){
+                    for(int ch = 0 ; ch < 3 ; ch++){
+                        split[ch][s] = _mm_loadu_si128((const __m128i*) masks.split[ch][s]);
+                    }
+                    join[s] = _mm_loadu_si128((const __m128i*) masks.join[s]);
+                }
+                size_t i = 0;
+                for( ; i + 16 <= n ; i += 16){
+                    __m128i v[3];
+                    for(int s = 0 ; s < 3 ; s++){
+                        v[s] = _mm_loadu_si128((const __m128i*) (b + 3 * i + 16 * s));
+                    }
+                    __m128i sum_lo = zero, sum_hi = zero;
+                    for(int ch = 0 ; ch < 3 ; ch++){
+                        __m128i c = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], split[ch][0]),
+                                                              _mm_shuffle_epi8(v[1], split[ch][1])),
+                                                 _mm_shuffle_epi8(v[2], split[ch][2]));
+                        sum_lo = _mm_add_epi16(sum_lo, _mm_unpacklo_epi8(c, zero));
+                        sum_hi = _mm_add_epi16(sum_hi, _mm_unpackhi_epi8(c, zero));
+                    }
+                    __m128i g_lo = _mm_srli_epi16(_mm_mulhi_epu16(sum_lo, div3), DIV3_SHIFT);
+                    __m128i g_hi = _mm_srli_epi16(_mm_mulhi_epu16(sum_hi, div3), DIV3_SHIFT);
+                    __m128i gray = _mm_packus_epi16(g_lo, g_hi);
+                    for(int s = 0 ; s < 3 ; s++){
+                        _mm_storeu_si128((__m128i*) (b + 3 * i + 16 * s), _mm_shuffle_epi8(gray, join[s]));
+                    }
+                }
+                gray_scalar(p + i, n - i);
+            }
+
+            struct cpu_features {
+                isa best;
+                bool ssse3;
+                cpu_features() {
+                    __builtin_cpu_init();
+                    ssse3 = __builtin_cpu_supports("ssse3");
+                    if (__builtin_cpu_supports("avx2")) {
+                        best = AVX2;
+                    } else if (__builtin_cpu_supports("sse2")) {
+                        best = SSE2;
+                    } else {
+                        best = SCALAR;
+                    }
+                }
+            };
+
+            const cpu_features& cpu() {
+                static const cpu_features features;
+                return features;
+            }
+#endif
+
+            std::atomic<int>& selected() {
+                static std::atomic<int> level(best_isa());
+                return level;
+            }
+        }
+
+        isa best_isa() {
+#ifdef RGB_X86_KERNELS
+            return cpu().best;
+#else
+            return SCALAR;
+#endif
+        }
+
+        isa current_isa() {
+            return (isa) selected().load(std::memory_order_relaxed);
+        }
+
+        void use_isa(isa level) {
+            if (level > best_isa()) {
+                level = best_isa();
+            }
+            selected().store(level, std::memory_order_relaxed);
+        }
+
+        const char* isa_name(isa level) {
+            switch (level) {
+                case AVX2: return "avx2";
+                case SSE2: return "sse2";
+                default: return "scalar";
+            }
+        }
+
+        void invert(color* p, size_t n) {
+#ifdef RGB_X86_KERNELS
+            switch (current_isa()) {
+                case AVX2: invert_avx2(p, n); return;
+                case SSE2: invert_sse2(p, n); return;
+                default: break;
+            }
+#endif
+            invert_scalar(p, n);
+        }
+
+        void to_gray_scale(color* p, size_t n) {
+#ifdef RGB_X86_KERNELS
+            // a separação das componentes precisa de pshufb (SSSE3)
+            if (current_isa() != SCALAR && cpu().ssse3) {
+                gray_ssse3(p, n);
+                return;
+            }
+#endif
+            gray_scalar(p, n);
+        }
+
+        void mix(color* p, const color* q, size_t n, int f) {
+            rgb_value* a = reinterpret_cast<rgb_value*>(p);
+            const rgb_value* b = reinterpret_cast<const rgb_value*>(q);
+#ifdef RGB_X86_KERNELS
+            // fora de [0,100] os produtos saem dos 16 bits: fica a versão byte a byte
+            if (f >= 0 && f <= 100) {
+                switch (current_isa()) {
+                    case AVX2: mix_avx2(a, b, n * 3, f); return;
+                    case SSE2: mix_sse2(a, b, n * 3, f); return;
+                    default: break;
+                }
+            }
+#endif
+            if (f >= 0 && f <= 100) {
+                mix_swar(a, b, n * 3, f);
+                return;
+            }
+            mix_scalar(a, b, n * 3, f);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+//! @file kernels.hpp
+#ifndef __rgb_kernels_hpp__
+#define __rgb_kernels_hpp__
+
+#include <cstddef>
+#include <rgb/color.hpp>
+
+namespace rgb {
+    //! Kernels que aplicam as operações de rgb::color a sequências de pixeis
+    //!
+    //! cada kernel tem uma versão escalar (SWAR, 8 componentes por palavra de
+    //! 64 bits, na inversão e na mistura) e versões SSE2/SSSE3/AVX2, escolhidas
+    //! em tempo de execução conforme o processador; todas dão exatamente o mesmo
+    //! resultado que as funções membro de rgb::color
+    namespace kernels {
+        //! Conjuntos de instruções que os kernels podem usar
+        enum isa { SCALAR, SSE2, AVX2 };
+        //! Obtem o melhor conjunto de instruções suportado pelo processador
+        //!
+        //! \return rgb::kernels::isa
+        isa best_isa();
+        //! Obtem o conjunto de instruções em uso
+        //!
+        //! \return rgb::kernels::isa
+        isa current_isa();
+        //! Limita o conjunto de instruções a usar (útil para testar a versão escalar)
+        //!
+        //! \param level conjunto pretendido (nunca acima de best_isa())
+        void use_isa(isa level);
+        //! Obtem o nome de um conjunto de instruções
+        //!
+        //! \param level conjunto de instruções
+        //! \return nome legível
+        const char* isa_name(isa level);
+        //! Inverte n pixeis consecutivos (color::invert())
+        //!
+        //! \param p primeiro pixel
+        //! \param n número de pixeis
+        void invert(color* p, size_t n);
+        //! Converte n pixeis consecutivos para escala de cinzento (color::to_gray_scale())
+        //!
+        //! \param p primeiro pixel
+        //! \param n número de pixeis
+        void to_gray_scale(color* p, size_t n);
+        //! Mistura n pixeis consecutivos com os pixeis correspondentes de q (color::mix())
+        //!
+        //! \param p primeiro pixel a alterar
+        //! \param q primeiro pixel a misturar
+        //! \param n número de pixeis
+        //! \param f fator
+        void mix(color* p, const color* q, size_t n, int f);
+    }
+}
+#endif
@@ -0,0 +1,111 @@
+#include <new>
+
+#include <rgb/memory.hpp>
+
+namespace rgb {
+    namespace memory {
+        namespace {
+            //! Bytes reservados pela thread
+            thread_local unsigned long long bytes_total = 0;
+            //! Conta das reservas da thread
+            thread_local std::shared_ptr<account> mine;
+
+            //! Sobe um máximo até value, se value for maior
+            void raise(std::atomic<size_t>& max, size_t value) {
+                size_t old = max.load();
+                while (old < value && !max.compare_exchange_weak(old, value)) {
+                }
+            }
+        }
+
+        account::account(size_t budget) : used(0), top(0), window(0), count(0), limit(budget) {}
+
+        size_t account::live() const {
+            return used;
+        }
+
+        size_t account::peak() const {
+            return top;
+        }
+
+        unsigned long long account::allocations() const {
+            return count;
+        }
+
+        size_t account::budget() const {
+            return limit;
+        }
+
+        void account::set_budget(size_t bytes) {
+            limit = bytes;
+        }
+
+        void account::start_window() {
+            window = used.load();
+        }
+
+        size_t account::window_peak() const {
+            return window;
+        }
+
+        bool account::add(size_t bytes) {
+            size_t old = used.load();
+            do {
+                if (limit != 0 && old + bytes > limit) {
+                    return false;
+                }
+            } while (!used.compare_exchange_weak(old, old + bytes));
+            raise(top, old + bytes);
+            raise(window, old + bytes);
+            count++;
+            return true;
+        }
+
+        void account::remove(size_t bytes) {
+            used -= bytes;
+        }
+
+        scope::scope(const std::shared_ptr<account>& a) : previous(mine) {
+            mine = a;
+        }
+
+        scope::~scope() {
+            mine = previous;
+        }
+
+        std::shared_ptr<account> current() {
+            return mine;
+        }
+
+        account& total() {
+            static account all;
+            return all;
+        }
+
+        std::shared_ptr<account> acquire(size_t bytes) {
+            if (!total().add(bytes)) {
+                throw std::bad_alloc();
+            }
+            if (mine && !mine->add(bytes)) {
+                total().remove(bytes);
+                throw std::bad_alloc();
+            }
+            return mine;
+        }
+
+        void release(const std::shared_ptr<account>& owner, size_t bytes) {
+            total().remove(bytes);
+            if (owner) {
+                owner->remove(bytes);
+            }
+        }
+
+        void count(size_t bytes) {
+            bytes_total += bytes;
+        }
+
+        unsigned long long allocated() {
+            return bytes_total;
+        }
+    }
+}
@@ -0,0 +1,119 @@
+//! @file memory.hpp
+#ifndef __rgb_memory_hpp__
+#define __rgb_memory_hpp__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace rgb {
+    //! Contagem da memória reservada para imagens
+    //!
+    //! há dois tipos de contagem:
+    //! - os bytes reservados por cada thread (count() e allocated()), incluindo os
+    //!   temporários dos descodificadores, que servem para medir cada operação;
+    //! - as contas (memory::account) dos buffers de pixeis, com os bytes vivos, o
+    //!   máximo atingido e o número de reservas; cada buffer é atribuído à conta
+    //!   da thread que o reservou (memory::scope) e a total(), e devolvido às
+    //!   mesmas contas quando é libertado, seja em que thread for. As faixas de
+    //!   parallel::for_rows() usam a conta da thread que as pediu
+    namespace memory {
+        //! Conta dos buffers de pixeis (de um script, ou de todo o processo)
+        class account {
+        public:
+            //! Construtor
+            //!
+            //! \param budget máximo de bytes vivos (0 para não haver máximo)
+            explicit account(size_t budget = 0);
+            //! Obtem os bytes dos buffers ainda vivos
+            //!
+            //! \return bytes vivos
+            size_t live() const;
+            //! Obtem o máximo de bytes vivos ao mesmo tempo
+            //!
+            //! \return pico de memória
+            size_t peak() const;
+            //! Obtem o número de buffers reservados
+            //!
+            //! \return número de reservas
+            unsigned long long allocations() const;
+            //! Obtem o máximo de bytes vivos
+            //!
+            //! \return orçamento (0 se não houver)
+            size_t budget() const;
+            //! Define o máximo de bytes vivos
+            //!
+            //! uma reserva que o ultrapasse falha (std::bad_alloc) antes de ser feita
+            //! \param bytes orçamento (0 para não haver máximo)
+            void set_budget(size_t bytes);
+            //! Começa uma janela de medição: window_peak() passa a ser live()
+            void start_window();
+            //! Obtem o máximo de bytes vivos desde o último start_window()
+            //!
+            //! \return pico de memória da janela
+            size_t window_peak() const;
+        private:
+            friend std::shared_ptr<account> acquire(size_t bytes);
+            friend void release(const std::shared_ptr<account>& owner, size_t bytes);
+            //! Soma bytes aos vivos, se couberem no orçamento
+            //!
+            //! \return false se o orçamento seria ultrapassado
+            bool add(size_t bytes);
+            //! Subtrai bytes aos vivos
+            void remove(size_t bytes);
+            //! Campos para guardar os bytes vivos, o pico e o pico da janela
+            std::atomic<size_t> used, top, window;
+            //! Campo para guardar o número de reservas
+            std::atomic<unsigned long long> count;
+            //! Campo para guardar o orçamento
+            std::atomic<size_t> limit;
+        };
+
+        //! Atribui à conta a as reservas da thread atual, enquanto existir
+        class scope {
+        public:
+            //! Construtor
+            //!
+            //! \param a conta (NULL para as reservas só contarem em total())
+            explicit scope(const std::shared_ptr<account>& a);
+            //! Destrutor: volta a usar a conta anterior
+            ~scope();
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+        private:
+            //! Campo para guardar a conta anterior
+            std::shared_ptr<account> previous;
+        };
+
+        //! Obtem a conta das reservas da thread atual
+        //!
+        //! \return conta (NULL se nenhum scope estiver ativo)
+        std::shared_ptr<account> current();
+        //! Obtem a conta de todo o processo
+        //!
+        //! \return conta com todos os buffers de pixeis
+        account& total();
+        //! Regista um buffer de pixeis na conta atual e em total()
+        //!
+        //! lança std::bad_alloc, sem registar nada, se algum orçamento fosse ultrapassado
+        //! \param bytes tamanho do buffer
+        //! \return conta a passar a release() quando o buffer for libertado
+        std::shared_ptr<account> acquire(size_t bytes);
+        //! Regista a libertação de um buffer
+        //!
+        //! \param owner conta devolvida por acquire()
+        //! \param bytes tamanho do buffer
+        void release(const std::shared_ptr<account>& owner, size_t bytes);
+
+        //! Regista uma reserva de memória feita pela thread atual
+        //!
+        //! \param bytes número de bytes reservados
+        void count(size_t bytes);
+        //! Obtem o total de bytes reservados pela thread atual
+        //!
+        //! a diferença entre duas chamadas é o que foi reservado entre elas
+        //! \return bytes reservados desde o início da thread
+        unsigned long long allocated();
+    }
+}
+#endif
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rgb/memory.hpp>
+#include <rgb/parallel.hpp>
+#include <rgb/pixel_pool.hpp>
+#include <rgb/trace.hpp>
+
+namespace rgb {
+    namespace parallel {
+        namespace {
+            //! Custo mínimo de uma faixa: abaixo disto não compensa acordar threads
+            const size_t MIN_BAND_COST = 1 << 15;
+            //! Número máximo de faixas por thread
+            const int BANDS_PER_THREAD = 4;
+
+            //! Indica se a thread está a executar uma faixa (set_threads() não pode ser chamada)
+            thread_local bool in_band = false;
+
+            //! Um pedido de for_rows(), partilhado pelas threads que nele participam
+            struct job {
+                const std::function<void(int, int)>* body;
+                int rows;
+                int bands;
+                std::atomic<int> next;
+                std::atomic<int> remaining;
+                //! Primeira exceção lançada por uma faixa, relançada na thread que chamou for_rows()
+                std::exception_ptr error;
+                std::atomic<bool> failed;
+                std::mutex error_lock;
+                //! Conta de memória e reserva de buffers da thread que chamou for_rows(),
+                //! usadas também pelas outras threads (ambas são thread_local)
+                std::shared_ptr<memory::account> account;
+                std::shared_ptr<pixel_pool> pool;
+
+                //! Executa faixas até não haver mais nenhuma por atribuir
+                //!
+                //! depois de uma faixa falhar, as restantes são só contadas, sem executar body
+                //! \return true se executou a última faixa do pedido
+                bool run() {
+                    memory::scope in(account);
+                    pixel_pool::scope from(pool);
+                    bool last = false;
+                    int b;
+                    while ((b = next.fetch_add(1)) < bands) {
+                        if (!failed.load()) {
+                            trace::span t("parallel", "band");
+                            in_band = true;
+                            try {
+                                (*body)((int) ((long long) rows * b / bands),
+                                        (int) ((long long) rows * (b + 1) / bands));
+                            } catch (...) {
+                                std::lock_guard<std::mutex> lock(error_lock);
+                                if (!error) {
+                                    error = std::current_exception();
+                                }
+                                failed = true;
+                            }
+                            in_band = false;
+                        }
+                        last = remaining.fetch_sub(1) == 1;
+                    }
+                    return last;
+                }
+            };
+
+            class pool {
+            public:
+                explicit pool(int n) : generation(0), stop(false) {
+                    for (int i = 1; i < n; i++) {
+                        workers.push_back(std::thread(&pool::work, this, i));
+                    }
+                }
+
+                ~pool() {
+                    {
+                        std::lock_guard<std::mutex> lock(m);
+                        stop = true;
+                    }
+                    wake.notify_all();
+                    for (std::thread& t : workers) {
+                        t.join();
+                    }
+                }
+
+                int size() const {
+                    return (int) workers.size() + 1;
+                }
+
+                //! Reparte o pedido pelas threads; a thread que chama também trabalha
+                void run(const std::shared_ptr<job>& j) {
+                    {
+                        std::lock_guard<std::mutex> lock(m);
+                        current = j;
+                        generation++;
+                    }
+                    wake.notify_all();
+                    j->run();
+                    std::unique_lock<std::mutex> lock(m);
+                    finished.wait(lock, [&j] { return j->remaining.load() == 0; });
+                    current.reset();
+                    lock.unlock();
+                    if (j->error) {
+                        std::rethrow_exception(j->error);
+                    }
+                }
+
+                //! Garante que só um for_rows() usa as threads de cada vez
+                std::mutex busy;
+
+            private:
+                void work(int self) {
+                    trace::name_thread("worker " + std::to_string(self));
+                    unsigned seen = 0;
+                    for (;;) {
+                        std::shared_ptr<job> j;
+                        {
+                            std::unique_lock<std::mutex> lock(m);
+                            wake.wait(lock, [&] { return stop || generation != seen; });
+                            if (stop) {
+                                return;
+                            }
+                            seen = generation;
+                            j = current;
+                        }
+                        if (j && j->run()) {
+                            std::lock_guard<std::mutex> lock(m);
+                            finished.notify_all();
+                        }
+                    }
+                }
+
+                std::vector<std::thread> workers;
+                std::mutex m;
+                std::condition_variable wake;
+                std::condition_variable finished;
+                std::shared_ptr<job> current;
+                unsigned generation;
+                bool stop;
+            };
+
+            std::mutex config;
+            int requested = 0;
+            std::unique_ptr<pool> instance;
+
+            int resolve(int n) {
+                if (n <= 0) {
+                    n = (int) std::thread::hardware_concurrency();
+                }
+                return n <= 0 ? 1 : n;
+            }
+
+            pool& get() {
+                std::lock_guard<std::mutex> lock(config);
+                if (!instance) {
+                    instance.reset(new pool(resolve(requested)));
+                }
+                return *instance;
+            }
+        }
+
+        void set_threads(int n) {
+            // dentro de uma faixa, for_rows() tem busy e a espera por ela nunca acabaria
+            assert(!in_band && "set_threads() cannot be called from inside for_rows()");
+            std::lock_guard<std::mutex> lock(config);
+            requested = n;
+            if (instance && instance->size() != resolve(n)) {
+                std::lock_guard<std::mutex> idle(instance->busy);
+                instance.reset();
+            }
+        }
+
+        int threads() {
+            return get().size();
+        }
+
+        void for_rows(int rows, size_t row_cost, const std::function<void(int, int)>& body) {
+            if (rows <= 0) {
+                return;
+            }
+            pool& p = get();
+            size_t by_cost = (size_t) rows * std::max<size_t>(row_cost, 1) / MIN_BAND_COST;
+            // algumas faixas por thread para equilibrar a carga entre elas
+            int bands = (int) std::min<size_t>(std::min<size_t>(by_cost, rows), p.size() * BANDS_PER_THREAD);
+            std::unique_lock<std::mutex> lock(p.busy, std::try_to_lock);
+            if (p.size() == 1 || bands <= 1 || !lock.owns_lock()) {
+                body(0, rows);
+                return;
+            }
+            std::shared_ptr<job> j = std::make_shared<job>();
+            j->body = &body;
+            j->rows = rows;
+            j->bands = bands;
+            j->next = 0;
+            j->remaining = bands;
+            j->failed = false;
+            j->account = memory::current();
+            j->pool = pixel_pool::current();
+            p.run(j);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+//! @file parallel.hpp
+#ifndef __rgb_parallel_hpp__
+#define __rgb_parallel_hpp__
+
+#include <cstddef>
+#include <functional>
+
+namespace rgb {
+    //! Execução paralela das operações sobre imagens
+    //!
+    //! as operações dividem a imagem em faixas de linhas que são processadas por
+    //! um conjunto fixo de threads; cada faixa escreve só nas suas linhas, por isso
+    //! o resultado é sempre igual ao da execução com uma só thread
+    namespace parallel {
+        //! Define o número de threads a usar
+        //!
+        //! deve ser chamada no arranque, antes de começar a processar imagens, e
+        //! nunca a partir de uma faixa de for_rows() (a espera pelas threads nunca
+        //! acabaria; verificado com assert)
+        //! \param n número de threads (0 usa o número de cores da máquina, 1 desliga o paralelismo)
+        void set_threads(int n);
+        //! Obtem o número de threads em uso
+        //!
+        //! \return número de threads
+        int threads();
+        //! Executa body sobre faixas [y0, y1) que cobrem as linhas [0, rows)
+        //!
+        //! trabalhos pequenos, ou chamados quando as threads já estão ocupadas
+        //! (por exemplo a partir de outra faixa), correm na thread que chama. Se
+        //! body lançar uma exceção numa faixa, as faixas ainda não começadas não
+        //! são executadas e a exceção é relançada aqui, depois de as outras threads
+        //! terminarem as suas. As faixas usam a conta de memória (memory::scope) e a
+        //! reserva de buffers (pixel_pool::scope) da thread que chama, seja qual for
+        //! a thread que as executa
+        //! \param rows número de linhas
+        //! \param row_cost custo de uma linha (normalmente o número de pixeis)
+        //! \param body função chamada com o início e o fim de cada faixa
+        void for_rows(int rows, size_t row_cost, const std::function<void(int, int)>& body);
+    }
+}
+#endif
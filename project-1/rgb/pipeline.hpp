@@ -0,0 +1,175 @@
+//! @file pipeline.hpp
+#ifndef __rgb_pipeline_hpp__
+#define __rgb_pipeline_hpp__
+
+#include <utility>
+#include <rgb/color.hpp>
+
+namespace rgb {
+    //! Operações por pixel combinadas em tempo de compilação
+    //!
+    //! cada operação é um tipo com operator()(color&) e o operador | junta duas
+    //! operações num só tipo, que as aplica por ordem ao mesmo pixel; por exemplo
+    //! img.apply(pipeline::invert() | pipeline::to_gray_scale()) faz uma só passagem
+    //! pela imagem com o mesmo resultado que img.invert() seguido de img.to_gray_scale().
+    //! Ao contrário de rgb::pixel_op (escolhida em tempo de execução, usada pelos
+    //! scripts), o compilador vê a cadeia toda e pode gerar um só ciclo sem chamadas
+    namespace pipeline {
+        //! Base das operações: só serve para o operador | reconhecer os tipos
+        //!
+        //! \tparam S tipo da operação (que deriva de stage<S>)
+        template <class S>
+        struct stage {
+            //! Obtem a operação concreta
+            //!
+            //! \return referência para a operação
+            const S& self() const {
+                return static_cast<const S&>(*this);
+            }
+        };
+
+        //! Duas operações aplicadas por ordem a cada pixel
+        template <class A, class B>
+        class chain : public stage<chain<A, B> > {
+        public:
+            //! Construtor
+            //!
+            //! \param first operação aplicada primeiro
+            //! \param second operação aplicada depois
+            chain(const A& first, const B& second) : first(first), second(second) {}
+            void operator()(color& c) const {
+                first(c);
+                second(c);
+            }
+        private:
+            //! Campo para guardar a operação aplicada primeiro
+            A first;
+            //! Campo para guardar a operação aplicada depois
+            B second;
+        };
+
+        //! Operação equivalente a color::invert()
+        struct invert_stage : stage<invert_stage> {
+            void operator()(color& c) const {
+                c.invert();
+            }
+        };
+
+        //! Operação equivalente a color::to_gray_scale()
+        struct gray_stage : stage<gray_stage> {
+            void operator()(color& c) const {
+                c.to_gray_scale();
+            }
+        };
+
+        //! Operação que troca uma cor por outra
+        class replace_stage : public stage<replace_stage> {
+        public:
+            //! Construtor
+            //!
+            //! \param a cor a substituir
+            //! \param b cor substituta
+            replace_stage(const color& a, const color& b) : a(a), b(b) {}
+            void operator()(color& c) const {
+                if(c == a){
+                    c = b;
+                }
+            }
+        private:
+            //! Campo para guardar a cor a substituir
+            color a;
+            //! Campo para guardar a cor substituta
+            color b;
+        };
+
+        //! Operação equivalente a color::mix() com uma cor fixa
+        class mix_stage : public stage<mix_stage> {
+        public:
+            //! Construtor
+            //!
+            //! \param c cor a misturar
+            //! \param f fator a misturar
+            mix_stage(const color& c, int f) : c(c), f(f) {}
+            void operator()(color& p) const {
+                p.mix(c, f);
+            }
+        private:
+            //! Campo para guardar a cor a misturar
+            color c;
+            //! Campo para guardar o fator
+            int f;
+        };
+
+        //! Operação definida por quem usa a biblioteca
+        //!
+        //! \tparam F tipo chamável com um color& (por exemplo uma lambda)
+        template <class F>
+        class each_stage : public stage<each_stage<F> > {
+        public:
+            //! Construtor
+            //!
+            //! \param f função a aplicar a cada pixel
+            explicit each_stage(const F& f) : f(f) {}
+            void operator()(color& c) const {
+                f(c);
+            }
+        private:
+            //! Campo para guardar a função
+            F f;
+        };
+
+        //! Junta duas operações: a da esquerda é aplicada primeiro
+        //!
+        //! \param a primeira operação
+        //! \param b segunda operação
+        //! \return rgb::pipeline::chain
+        template <class A, class B>
+        chain<A, B> operator|(const stage<A>& a, const stage<B>& b) {
+            return chain<A, B>(a.self(), b.self());
+        }
+
+        //! Operação equivalente a image::invert()
+        //!
+        //! \return rgb::pipeline::invert_stage
+        inline invert_stage invert() {
+            return invert_stage();
+        }
+
+        //! Operação equivalente a image::to_gray_scale()
+        //!
+        //! \return rgb::pipeline::gray_stage
+        inline gray_stage to_gray_scale() {
+            return gray_stage();
+        }
+
+        //! Operação equivalente a image::replace()
+        //!
+        //! \param a cor a substituir
+        //! \param b cor substituta
+        //! \return rgb::pipeline::replace_stage
+        inline replace_stage replace(const color& a, const color& b) {
+            return replace_stage(a, b);
+        }
+
+        //! Operação que mistura cada pixel com uma cor (color::mix())
+        //!
+        //! \param c cor a misturar
+        //! \param f fator a misturar
+        //! \return rgb::pipeline::mix_stage
+        inline mix_stage mix(const color& c, int f) {
+            return mix_stage(c, f);
+        }
+
+        //! Operação que aplica uma função a cada pixel
+        //!
+        //! a função é chamada em paralelo para bandas diferentes da imagem, por
+        //! isso não deve alterar estado partilhado sem sincronização
+        //! \param f função com um parâmetro color&
+        //! \return rgb::pipeline::each_stage
+        template <class F>
+        each_stage<F> each(const F& f) {
+            return each_stage<F>(f);
+        }
+    }
+}
+#endif
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <sstream>
+#include <rgb/kernels.hpp>
+#include <rgb/pixel_op.hpp>
+
+namespace rgb {
+    pixel_op::pixel_op(kind op) : op(op), factor(0) {}
+
+    pixel_op pixel_op::invert() {
+        return pixel_op(INVERT);
+    }
+
+    pixel_op pixel_op::to_gray_scale() {
+        return pixel_op(TO_GRAY_SCALE);
+    }
+
+    pixel_op pixel_op::replace(const color& a, const color& b) {
+        pixel_op result(REPLACE);
+        result.a = a;
+        result.b = b;
+        return result;
+    }
+
+    pixel_op pixel_op::mix(const image_view& v, int factor) {
+        pixel_op result(MIX);
+        result.operand = std::make_shared<image_view>(v);
+        result.factor = factor;
+        return result;
+    }
+
+    pixel_op::kind pixel_op::type() const {
+        return op;
+    }
+
+    void pixel_op::run(color* p, int x, int y, size_t n) const {
+        switch (op) {
+            case INVERT:
+                kernels::invert(p, n);
+                break;
+            case TO_GRAY_SCALE:
+                kernels::to_gray_scale(p, n);
+                break;
+            case REPLACE:
+                for(color* end = p + n ; p < end ; p++){
+                    if(*p == a){
+                        *p = b;
+                    }
+                }
+                break;
+            case MIX:
+                //tal como image::mix(), só a zona comum às duas imagens é misturada
+                if(y < operand->height() && x < operand->width()){
+                    size_t m = std::min(n, (size_t) (operand->width() - x));
+                    kernels::mix(p, operand->row(y) + x, m, factor);
+                }
+                break;
+        }
+    }
+
+    std::string pixel_op::describe() const {
+        std::ostringstream out;
+        switch (op) {
+            case INVERT:
+                out << "invert";
+                break;
+            case TO_GRAY_SCALE:
+                out << "to_gray_scale";
+                break;
+            case REPLACE:
+                out << "replace " << (int) a.red() << ' ' << (int) a.green() << ' ' << (int) a.blue()
+                    << ' ' << (int) b.red() << ' ' << (int) b.green() << ' ' << (int) b.blue();
+                break;
+            case MIX:
+                out << "mix " << operand->width() << 'x' << operand->height() << ' ' << factor;
+                break;
+        }
+        return out.str();
+    }
+}
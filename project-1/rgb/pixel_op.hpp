@@ -0,0 +1,72 @@
+//! @file pixel_op.hpp
+#ifndef __rgb_pixel_op_hpp__
+#define __rgb_pixel_op_hpp__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <rgb/color.hpp>
+#include <rgb/image_view.hpp>
+
+namespace rgb {
+    //! Operação que altera cada pixel sem depender dos pixeis vizinhos
+    //!
+    //! várias destas operações podem ser aplicadas numa só passagem pela imagem
+    //! (image::apply()), com o mesmo resultado que aplicá-las uma de cada vez
+    class pixel_op {
+    public:
+        //! Tipos de operação
+        enum kind { INVERT, TO_GRAY_SCALE, REPLACE, MIX };
+        //! Operação equivalente a image::invert()
+        //!
+        //! \return rgb::pixel_op
+        static pixel_op invert();
+        //! Operação equivalente a image::to_gray_scale()
+        //!
+        //! \return rgb::pixel_op
+        static pixel_op to_gray_scale();
+        //! Operação equivalente a image::replace()
+        //!
+        //! \param a cor a substituir
+        //! \param b cor substituta
+        //! \return rgb::pixel_op
+        static pixel_op replace(const color& a, const color& b);
+        //! Operação equivalente a image::mix()
+        //!
+        //! \param v vista a misturar (o pixel (x,y) mistura-se com v.at(x,y))
+        //! \param factor fator a misturar
+        //! \return rgb::pixel_op
+        static pixel_op mix(const image_view& v, int factor);
+        //! Obtem o tipo da operação
+        //!
+        //! \return rgb::pixel_op::kind
+        kind type() const;
+        //! Aplica a operação a n pixeis consecutivos de uma linha
+        //!
+        //! \param p apontador para o pixel (x,y)
+        //! \param x coluna do primeiro pixel
+        //! \param y linha dos pixeis
+        //! \param n número de pixeis
+        void run(color* p, int x, int y, size_t n) const;
+        //! Obtem uma descrição legível da operação
+        //!
+        //! \return texto com o nome e os argumentos
+        std::string describe() const;
+    private:
+        //! Construtor usado pelas funções de criação
+        //!
+        //! \param op tipo da operação
+        explicit pixel_op(kind op);
+        //! Campo para guardar o tipo da operação
+        kind op;
+        //! Campo para guardar a cor a substituir (REPLACE)
+        color a;
+        //! Campo para guardar a cor substituta (REPLACE)
+        color b;
+        //! Campo para guardar a vista a misturar (MIX)
+        std::shared_ptr<image_view> operand;
+        //! Campo para guardar o fator (MIX)
+        int factor;
+    };
+}
+#endif
@@ -0,0 +1,92 @@
+#include <rgb/pixel_pool.hpp>
+
+namespace rgb {
+    namespace {
+        //! Tamanho da classe mais pequena (uma página)
+        const size_t MIN_CLASS = 4096;
+
+        //! Reserva da thread
+        thread_local std::shared_ptr<pixel_pool> mine;
+    }
+
+    const size_t pixel_pool::DEFAULT_MAX_IDLE;
+
+    pixel_pool::pixel_pool(size_t max_idle) : max_idle(max_idle), unused(0), hits(0), misses(0) {}
+
+    pixel_pool::~pixel_pool() {
+        for (auto& c : free) {
+            for (rgb_value* p : c.second) {
+                delete [] p;
+            }
+        }
+    }
+
+    size_t pixel_pool::size_class(size_t bytes) {
+        if (bytes <= MIN_CLASS) {
+            return MIN_CLASS;
+        }
+        // entre p / 2 e p as classes são múltiplos de p / 8
+        size_t p = MIN_CLASS;
+        while (p < bytes) {
+            p *= 2;
+        }
+        size_t step = p / 8;
+        return (bytes + step - 1) / step * step;
+    }
+
+    rgb_value* pixel_pool::take(size_t bytes, size_t& capacity) {
+        capacity = size_class(bytes);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            auto c = free.find(capacity);
+            if (c != free.end() && !c->second.empty()) {
+                rgb_value* p = c->second.back();
+                c->second.pop_back();
+                unused -= capacity;
+                hits++;
+                return p;
+            }
+            misses++;
+        }
+        return new rgb_value[capacity];
+    }
+
+    void pixel_pool::give(rgb_value* p, size_t capacity) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (unused + capacity <= max_idle) {
+                free[capacity].push_back(p);
+                unused += capacity;
+                return;
+            }
+        }
+        delete [] p;
+    }
+
+    size_t pixel_pool::idle() const {
+        std::lock_guard<std::mutex> lock(m);
+        return unused;
+    }
+
+    unsigned long long pixel_pool::reused() const {
+        std::lock_guard<std::mutex> lock(m);
+        return hits;
+    }
+
+    unsigned long long pixel_pool::fresh() const {
+        std::lock_guard<std::mutex> lock(m);
+        return misses;
+    }
+
+    pixel_pool::scope::scope(const std::shared_ptr<pixel_pool>& p) : previous(mine) {
+        mine = p;
+    }
+
+    pixel_pool::scope::~scope() {
+        mine = previous;
+    }
+
+    std::shared_ptr<pixel_pool> pixel_pool::current() {
+        return mine;
+    }
+}
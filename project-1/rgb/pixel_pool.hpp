@@ -0,0 +1,96 @@
+//! @file pixel_pool.hpp
+#ifndef __rgb_pixel_pool_hpp__
+#define __rgb_pixel_pool_hpp__
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <rgb/color.hpp>
+
+namespace rgb {
+    //! Reserva de buffers de pixeis para reutilizar
+    //!
+    //! os buffers são arrumados por classes de tamanho (cada potência de 2 é
+    //! dividida em 4 classes, por isso sobram no máximo 25% de cada buffer); um
+    //! buffer libertado volta à sua classe e é dado à próxima imagem que precise
+    //! de um tamanho dessa classe, sem novas páginas nem novas falhas de página.
+    //! Enquanto um pixel_pool::scope estiver ativo numa thread, as imagens dessa
+    //! thread (image::allocate()) usam a reserva; um rgb::script tem a sua
+    class pixel_pool {
+    public:
+        //! Máximo, por omissão, de bytes guardados sem uso
+        static const size_t DEFAULT_MAX_IDLE = (size_t) 256 << 20;
+        //! Construtor
+        //!
+        //! \param max_idle máximo de bytes guardados sem uso; os buffers que não
+        //! cabem são libertados
+        explicit pixel_pool(size_t max_idle = DEFAULT_MAX_IDLE);
+        //! Destrutor: liberta os buffers guardados
+        ~pixel_pool();
+        pixel_pool(const pixel_pool&) = delete;
+        pixel_pool& operator=(const pixel_pool&) = delete;
+        //! Obtem um buffer não inicializado
+        //!
+        //! \param bytes tamanho pedido
+        //! \param capacity tamanho real do buffer (o da classe), a devolver a give()
+        //! \return buffer guardado da mesma classe, ou um novo se não houver
+        rgb_value* take(size_t bytes, size_t& capacity);
+        //! Devolve um buffer obtido com take(), para ser reutilizado
+        //!
+        //! pode ser chamada em qualquer thread
+        //! \param p buffer
+        //! \param capacity tamanho devolvido por take()
+        void give(rgb_value* p, size_t capacity);
+        //! Obtem os bytes guardados sem uso
+        //!
+        //! \return bytes à espera de serem reutilizados
+        size_t idle() const;
+        //! Obtem o número de pedidos servidos com um buffer guardado
+        //!
+        //! \return número de reutilizações
+        unsigned long long reused() const;
+        //! Obtem o número de pedidos que precisaram de um buffer novo
+        //!
+        //! \return número de buffers novos
+        unsigned long long fresh() const;
+        //! Calcula o tamanho da classe de um pedido
+        //!
+        //! \param bytes tamanho pedido
+        //! \return menor tamanho de classe maior ou igual a bytes
+        static size_t size_class(size_t bytes);
+
+        //! Faz as imagens da thread atual usar uma reserva, enquanto existir
+        class scope {
+        public:
+            //! Construtor
+            //!
+            //! \param p reserva (NULL para as imagens usarem o heap diretamente)
+            explicit scope(const std::shared_ptr<pixel_pool>& p);
+            //! Destrutor: volta a usar a reserva anterior
+            ~scope();
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+        private:
+            //! Campo para guardar a reserva anterior
+            std::shared_ptr<pixel_pool> previous;
+        };
+        //! Obtem a reserva usada pela thread atual
+        //!
+        //! \return reserva (NULL se nenhum scope estiver ativo)
+        static std::shared_ptr<pixel_pool> current();
+    private:
+        //! Campo para guardar o máximo de bytes sem uso
+        size_t max_idle;
+        //! Campo para guardar os buffers sem uso, por classe
+        std::map<size_t, std::vector<rgb_value*> > free;
+        //! Campo para guardar os bytes sem uso
+        size_t unused;
+        //! Campos para guardar as contagens de reutilizações e de buffers novos
+        unsigned long long hits, misses;
+        //! Campo para proteger os campos anteriores
+        mutable std::mutex m;
+    };
+}
+#endif
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <set>
+
+#include <rgb/profile.hpp>
+#include <rgb/trace.hpp>
+
+namespace rgb {
+    namespace {
+        //! Totais das entradas de um comando
+        struct summary {
+            std::string name;
+            int count;
+            double ms;
+            unsigned long long pixels;
+            unsigned long long bytes;
+            unsigned long long allocations;
+            unsigned long long peak;
+        };
+
+        //! Soma as entradas por nome de comando, do mais demorado para o menos
+        std::vector<summary> by_command(const std::vector<profile::entry>& list) {
+            std::map<std::string, summary> totals;
+            for (const profile::entry& e : list) {
+                summary& s = totals[e.name];
+                if (s.count == 0) {
+                    s.name = e.name;
+                }
+                s.count++;
+                s.ms += e.ms;
+                s.pixels += e.pixels;
+                s.bytes += e.bytes;
+                s.allocations += e.allocations;
+                s.peak = std::max(s.peak, e.peak);
+            }
+            std::vector<summary> result;
+            for (const auto& t : totals) {
+                result.push_back(t.second);
+            }
+            std::stable_sort(result.begin(), result.end(), [](const summary& a, const summary& b) {
+                return a.ms > b.ms;
+            });
+            return result;
+        }
+    }
+
+    profile::entry::entry() :
+        index(0), ms(0), pixels(0), bytes(0), allocations(0), peak(0),
+        width_before(0), height_before(0), width_after(0), height_after(0) {}
+
+    void profile::add(const entry& e) {
+        std::lock_guard<std::mutex> lock(m);
+        list.push_back(e);
+    }
+
+    std::vector<profile::entry> profile::entries() const {
+        std::lock_guard<std::mutex> lock(m);
+        return list;
+    }
+
+    void profile::print_table(std::ostream& out) const {
+        std::vector<entry> all = entries();
+        std::vector<summary> rows = by_command(all);
+        std::set<std::string> scripts;
+        double total = 0;
+        for (const entry& e : all) {
+            scripts.insert(e.script);
+            total += e.ms;
+        }
+        std::ios_base::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(2);
+        out << "Profile: " << all.size() << " operations in " << scripts.size() << " scripts, "
+            << total << " ms" << std::endl;
+        out << std::left << std::setw(16) << "command" << std::right
+            << std::setw(7) << "count" << std::setw(12) << "total ms" << std::setw(11) << "mean ms"
+            << std::setw(8) << "share" << std::setw(11) << "Mpixels" << std::setw(11) << "MiB alloc"
+            << std::setw(10) << "peak MiB" << std::endl;
+        for (const summary& s : rows) {
+            out << std::left << std::setw(16) << s.name << std::right
+                << std::setw(7) << s.count << std::setw(12) << s.ms << std::setw(11) << s.ms / s.count
+                << std::setw(7) << (total > 0 ? 100 * s.ms / total : 0) << '%'
+                << std::setw(11) << s.pixels / 1e6 << std::setw(11) << s.bytes / 1048576.0
+                << std::setw(10) << s.peak / 1048576.0 << std::endl;
+        }
+        out.flags(flags);
+    }
+
+    void profile::print_memory(std::ostream& out) const {
+        std::vector<entry> all = entries();
+        // scripts pela ordem da primeira entrada; as entradas de cada um estão pela ordem do plano
+        std::vector<std::string> scripts;
+        std::map<std::string, std::vector<const entry*> > by_script;
+        for (const entry& e : all) {
+            std::vector<const entry*>& list = by_script[e.script];
+            if (list.empty()) {
+                scripts.push_back(e.script);
+            }
+            list.push_back(&e);
+        }
+        std::ios_base::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(2);
+        for (const std::string& name : scripts) {
+            const std::vector<const entry*>& list = by_script[name];
+            unsigned long long peak = 0, allocations = 0;
+            for (const entry* e : list) {
+                peak = std::max(peak, e -> peak);
+                allocations += e -> allocations;
+            }
+            out << name << ": peak " << peak / 1048576.0 << " MiB, " << allocations << " allocations" << std::endl;
+            out << std::right << std::setw(6) << "#" << "  " << std::left << std::setw(36) << "command" << std::right
+                << std::setw(8) << "allocs" << std::setw(11) << "MiB alloc" << std::setw(10) << "peak MiB" << std::endl;
+            for (const entry* e : list) {
+                std::string command = e -> command.size() > 34 ? e -> command.substr(0, 31) + "..." : e -> command;
+                out << std::right << std::setw(6) << e -> index << "  " << std::left << std::setw(36) << command
+                    << std::right << std::setw(8) << e -> allocations << std::setw(11) << e -> bytes / 1048576.0
+                    << std::setw(10) << e -> peak / 1048576.0 << std::endl;
+            }
+        }
+        out.flags(flags);
+    }
+
+    void profile::write_json(std::ostream& out) const {
+        std::vector<entry> all = entries();
+        std::ios_base::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"operations\": [";
+        double ms = 0;
+        unsigned long long pixels = 0, bytes = 0;
+        for (size_t i = 0; i < all.size(); i++) {
+            const entry& e = all[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"script\": ";
+            json_string(out, e.script);
+            out << ", \"index\": " << e.index << ", \"name\": ";
+            json_string(out, e.name);
+            out << ", \"command\": ";
+            json_string(out, e.command);
+            out << ", \"ms\": " << e.ms << ", \"pixels\": " << e.pixels << ", \"bytes_allocated\": " << e.bytes
+                << ", \"allocations\": " << e.allocations << ", \"peak_bytes\": " << e.peak
+                << ", \"before\": {\"width\": " << e.width_before << ", \"height\": " << e.height_before << "}"
+                << ", \"after\": {\"width\": " << e.width_after << ", \"height\": " << e.height_after << "}}";
+            ms += e.ms;
+            pixels += e.pixels;
+            bytes += e.bytes;
+        }
+        out << "\n  ],\n  \"commands\": [";
+        std::vector<summary> rows = by_command(all);
+        for (size_t i = 0; i < rows.size(); i++) {
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+            json_string(out, rows[i].name);
+            out << ", \"count\": " << rows[i].count << ", \"ms\": " << rows[i].ms << ", \"pixels\": "
+                << rows[i].pixels << ", \"bytes_allocated\": " << rows[i].bytes << ", \"allocations\": "
+                << rows[i].allocations << ", \"peak_bytes\": " << rows[i].peak << "}";
+        }
+        out << "\n  ],\n  \"total\": {\"operations\": " << all.size() << ", \"ms\": " << ms
+            << ", \"pixels\": " << pixels << ", \"bytes_allocated\": " << bytes << "}\n}" << std::endl;
+        out.flags(flags);
+    }
+}
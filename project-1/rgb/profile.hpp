@@ -0,0 +1,75 @@
+//! @file profile.hpp
+#ifndef __rgb_profile_hpp__
+#define __rgb_profile_hpp__
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rgb {
+    //! Medições da execução de scripts, comando a comando (run_script --profile)
+    //!
+    //! os scripts (rgb::script::set_profile()) acrescentam uma entrada por cada
+    //! operação do plano; no fim pode ser escrito um resumo em tabela e todas as
+    //! entradas em JSON. Pode ser partilhado pelos scripts de um rgb::batch
+    class profile {
+    public:
+        //! Medições de uma operação
+        struct entry {
+            //! Construtor: medições a zero
+            entry();
+            //! Campo para guardar o ficheiro do script
+            std::string script;
+            //! Campo para guardar a posição da operação no plano
+            int index;
+            //! Campo para guardar o nome do comando (por exemplo "invert" ou "fused")
+            std::string name;
+            //! Campo para guardar o comando na sintaxe dos scripts
+            std::string command;
+            //! Campo para guardar o tempo de execução, em milissegundos
+            double ms;
+            //! Campo para guardar o número de pixeis lidos ou escritos pela operação
+            unsigned long long pixels;
+            //! Campo para guardar os bytes reservados durante a operação (rgb::memory)
+            unsigned long long bytes;
+            //! Campo para guardar o número de buffers de pixeis reservados durante a operação
+            unsigned long long allocations;
+            //! Campo para guardar o máximo de bytes de pixeis vivos do script durante a operação
+            unsigned long long peak;
+            //! Campos para guardar as dimensões da imagem antes da operação (0 se não houver imagem)
+            int width_before, height_before;
+            //! Campos para guardar as dimensões da imagem depois da operação
+            int width_after, height_after;
+        };
+        //! Acrescenta uma entrada
+        //!
+        //! pode ser chamada por várias threads ao mesmo tempo
+        //! \param e entrada
+        void add(const entry& e);
+        //! Obtem uma cópia das entradas, pela ordem em que foram acrescentadas
+        //!
+        //! \return entradas
+        std::vector<entry> entries() const;
+        //! Escreve um resumo por comando: número de execuções, tempo total, médio e
+        //! percentagem do total, pixeis e bytes reservados, do mais demorado para o menos
+        //!
+        //! \param out stream onde escrever
+        void print_table(std::ostream& out) const;
+        //! Escreve o uso de memória de cada script: o pico e o número de buffers
+        //! de pixeis e, por comando, as reservas, os bytes reservados e o pico
+        //!
+        //! \param out stream onde escrever
+        void print_memory(std::ostream& out) const;
+        //! Escreve todas as entradas e os totais em JSON
+        //!
+        //! \param out stream onde escrever
+        void write_json(std::ostream& out) const;
+    private:
+        //! Campo para guardar as entradas
+        std::vector<entry> list;
+        //! Campo para proteger as entradas
+        mutable std::mutex m;
+    };
+}
+#endif
@@ -4,6 +4,8 @@
 
 #include <rgb/color.hpp>
 #include <rgb/image.hpp>
+#include <rgb/image_cache.hpp>
+#include <rgb/image_view.hpp>
 #include <rgb/script.hpp>
 #include <png/png.hpp>
 
@@ -1,9 +1,18 @@
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
 
 #include <rgb/script.hpp>
 #include <png/png.hpp>
+#include <png/stream.hpp>
+#include <rgb/memory.hpp>
+#include <rgb/trace.hpp>
 
 namespace rgb {
     std::istream& operator>>(std::istream& input, color& c) {
@@ -14,118 +23,713 @@ namespace rgb {
         c.blue() = b;
         return input;
     }
-    script::script(const std::string& filename) :
-            img(NULL), input(filename), root_path(ROOT_PROJ_DIR) {}
 
-    script::~script() {
-        if (img != NULL) {
-            delete img;
+    std::ostream& operator<<(std::ostream& output, const color& c) {
+        return output << (int) c.red() << ' ' << (int) c.green() << ' ' << (int) c.blue();
+    }
+
+    namespace {
+        //! Número de pixeis do retângulo [x, x + w) x [y, y + h) dentro de [0, width) x [0, height)
+        unsigned long long area(int x, int w, int width, int y, int h, int height) {
+            long long x0 = std::max(x, 0), x1 = std::min((long long) x + w, (long long) width);
+            long long y0 = std::max(y, 0), y1 = std::min((long long) y + h, (long long) height);
+            return x1 > x0 && y1 > y0 ? (unsigned long long) ((x1 - x0) * (y1 - y0)) : 0;
+        }
+
+        //! Mede o tempo desde a construção
+        struct stopwatch {
+            std::chrono::steady_clock::time_point start;
+            stopwatch() : start(std::chrono::steady_clock::now()) {}
+            //! \return milissegundos desde a construção
+            double ms() const {
+                return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+        };
+
+        //! Soma a uma entrada do perfil o tempo, a memória reservada e o número de
+        //! buffers entre a construção e a destruição, e sobe o pico de memória da
+        //! entrada até ao da conta atual nesse intervalo
+        struct measure {
+            profile::entry& e;
+            stopwatch clock;
+            std::shared_ptr<memory::account> account;
+            unsigned long long bytes, allocations;
+            explicit measure(profile::entry& e) :
+                e(e), account(memory::current()), bytes(memory::allocated()), allocations(0) {
+                if (account) {
+                    allocations = account -> allocations();
+                    account -> start_window();
+                }
+            }
+            ~measure() {
+                e.ms += clock.ms();
+                e.bytes += memory::allocated() - bytes;
+                if (account) {
+                    e.allocations += account -> allocations() - allocations;
+                    e.peak = std::max<unsigned long long>(e.peak, account -> window_peak());
+                }
+            }
+        };
+
+        //! Lê o resto da linha (as opções de open e save), sem espaços nas pontas
+        std::string read_options(std::istream& input) {
+            std::string options;
+            std::getline(input, options);
+            options.erase(0, options.find_first_not_of(" \t\r"));
+            options.erase(options.find_last_not_of(" \t\r") + 1);
+            return options;
+        }
+
+        //! Interpreta as opções de open: "scale 1/2", "scale 1/4" ou "scale 1/8"
+        //!
+        //! \return false se as opções não forem válidas
+        bool parse_scale(const std::string& options, int& scale) {
+            std::istringstream words(options);
+            std::string word, value;
+            scale = 1;
+            while (words >> word) {
+                if (word != "scale" || !(words >> value)) {
+                    return false;
+                }
+                if (value == "1" || value == "1/1") {
+                    scale = 1;
+                } else if (value == "1/2" || value == "1/4" || value == "1/8") {
+                    scale = value[2] - '0';
+                } else {
+                    return false;
+                }
+            }
+            return true;
         }
     }
 
-    void script::process() {
-        while (!input.eof()) {
-            std::string command;
-            input >> command;
-            if (command.empty()) {
+    script::command::command(kind type, const std::string& name) :
+            type(type), name(name), x(0), y(0), w(0), h(0), factor(0), turns(0), merged(1) {}
+
+    bool script::command::per_pixel() const {
+        return type == INVERT || type == TO_GRAY_SCALE || type == REPLACE || type == MIX;
+    }
+
+    std::string script::command::describe() const {
+        std::ostringstream out;
+        switch (type) {
+            case OPEN:
+            case SAVE:
+                out << name << ' ' << file;
+                if (!options.empty()) {
+                    out << ' ' << options;
+                }
+                break;
+            case BLANK:
+                out << name << ' ' << w << ' ' << h << ' ' << a;
                 break;
+            case FILL:
+                out << name << ' ' << x << ' ' << y << ' ' << w << ' ' << h << ' ' << a;
+                break;
+            case REPLACE:
+                out << name << ' ' << a << ' ' << b;
+                break;
+            case CROP:
+                out << name << ' ' << x << ' ' << y << ' ' << w << ' ' << h;
+                break;
+            case ROTATE:
+                out << (turns == 3 ? "rotate_left" : "rotate_right");
+                if (turns == 2) {
+                    out << " x2";
+                }
+                break;
+            case MIX:
+                out << name << ' ' << file << ' ' << factor;
+                break;
+            case ADD:
+                out << name << ' ' << file << ' ' << a << ' ' << x << ' ' << y;
+                break;
+            case FUSED:
+                out << "fused pass (";
+                for (size_t i = 0; i < steps.size(); i++) {
+                    out << (i == 0 ? "" : "; ") << steps[i].describe();
+                }
+                out << ')';
+                break;
+            default:
+                out << name;
+        }
+        return out.str();
+    }
+
+    script::script(const std::string& filename, image_cache& cache) :
+            filename(filename), input(filename), root_path(ROOT_PROJ_DIR),
+            cache(cache), parsed(0), compiled(false), opened(false), band_rows(0), prof(NULL), touched(0),
+            mem(std::make_shared<memory::account>()), pool(std::make_shared<pixel_pool>()) {}
+
+    script::~script() {
+    }
+
+    bool script::parse(command& c) {
+        std::string name;
+        input >> name;
+        if (name.empty()) {
+            return false;
+        }
+        c = command(command::UNKNOWN, name);
+        if (name == "open") {
+            c.type = command::OPEN;
+            input >> c.file;
+            c.options = read_options(input);
+        } else if (name == "blank") {
+            c.type = command::BLANK;
+            input >> c.w >> c.h >> c.a;
+        } else if (name == "save") {
+            c.type = command::SAVE;
+            input >> c.file;
+            // opções do codificador no resto da linha, por exemplo "fast" ou "level 3"
+            c.options = read_options(input);
+        } else if (name == "fill") {
+            c.type = command::FILL;
+            input >> c.x >> c.y >> c.w >> c.h >> c.a;
+        } else if (name == "invert") {
+            c.type = command::INVERT;
+        } else if (name == "to_gray_scale") {
+            c.type = command::TO_GRAY_SCALE;
+        } else if (name == "replace") {
+            c.type = command::REPLACE;
+            input >> c.a >> c.b;
+        } else if (name == "crop") {
+            c.type = command::CROP;
+            input >> c.x >> c.y >> c.w >> c.h;
+        } else if (name == "rotate_left") {
+            c.type = command::ROTATE;
+            c.turns = 3;
+        } else if (name == "rotate_right") {
+            c.type = command::ROTATE;
+            c.turns = 1;
+        } else if (name == "mix") {
+            c.type = command::MIX;
+            input >> c.file >> c.factor;
+        } else if (name == "add") {
+            c.type = command::ADD;
+            input >> c.file >> c.a >> c.x >> c.y;
+        }
+        return true;
+    }
+
+    void script::push(const command& c) {
+        //sem imagem cada comando tem de chegar a execute() para dar o erro "No image loaded"
+        if (!opened) {
+            opened = c.type == command::OPEN || c.type == command::BLANK;
+            plan.push_back(c);
+            return;
+        }
+        command* top = plan.empty() ? NULL : &plan.back();
+        if (c.type == command::REPLACE && c.a == c.b) {
+            return;
+        }
+        if (top != NULL && top->type == c.type) {
+            if (c.type == command::INVERT) {
+                plan.pop_back();
+                return;
             }
-            std::cout << "Executing command '" << command << "' ..." << std::endl;
+            if (c.type == command::TO_GRAY_SCALE) {
+                top->merged += c.merged;
+                return;
+            }
+            if (c.type == command::ROTATE) {
+                top->turns = (top->turns + c.turns) % 4;
+                top->name = top->turns == 3 ? "rotate_left" : "rotate_right";
+                top->merged += c.merged;
+                if (top->turns == 0) {
+                    plan.pop_back();
+                }
+                return;
+            }
+        }
+        plan.push_back(c);
+    }
 
-            if (command == "open") {
-                open();
-            } else if (command == "blank") {
-                blank();
+    void script::fuse() {
+        std::vector<command> fused;
+        size_t i = 0;
+        while (i < plan.size() && plan[i].type != command::OPEN && plan[i].type != command::BLANK) {
+            fused.push_back(plan[i++]);
+        }
+        while (i < plan.size()) {
+            size_t j = i;
+            while (j < plan.size() && plan[j].per_pixel()) {
+                j++;
+            }
+            if (j - i < 2) {
+                fused.push_back(plan[i]);
+                i++;
+                continue;
             }
+            command pass(command::FUSED, "fused");
+            pass.merged = 0;
+            for ( ; i < j; i++) {
+                pass.steps.push_back(plan[i]);
+                pass.merged += plan[i].merged;
+            }
+            fused.push_back(pass);
+        }
+        plan.swap(fused);
+    }
 
-            // Other commands
-            if (img == NULL) {
-                std::cout << "No image loaded! Stopping ..." << std::endl;
-                break;
+    void script::compile() {
+        if (compiled) {
+            return;
+        }
+        command c(command::UNKNOWN, "");
+        while (!input.eof() && parse(c)) {
+            parsed++;
+            push(c);
+        }
+        fuse();
+        compiled = true;
+    }
+
+    void script::explain(std::ostream& out) {
+        compile();
+        out << "Plan for " << filename << ": " << parsed << " commands -> "
+            << plan.size() << " operations" << std::endl;
+        for (const command& c : plan) {
+            out << "  " << c.describe();
+            if (c.merged > 1) {
+                out << "  [" << c.merged << " commands]";
+            }
+            out << std::endl;
+        }
+    }
+
+    void script::set_band_rows(int rows) {
+        band_rows = rows;
+    }
+
+    void script::set_profile(profile* p) {
+        prof = p;
+    }
+
+    void script::set_memory_budget(size_t bytes) {
+        mem->set_budget(bytes);
+    }
+
+    const memory::account& script::memory_usage() const {
+        return *mem;
+    }
+
+    const pixel_pool& script::buffers() const {
+        return *pool;
+    }
+
+    void script::record(size_t index, profile::entry e) {
+        if (prof == NULL) {
+            return;
+        }
+        e.script = filename;
+        e.index = (int) index;
+        e.name = plan[index].name;
+        e.command = plan[index].describe();
+        prof -> add(e);
+    }
+
+    bool script::run(size_t index, std::ostream& out) {
+        profile::entry e;
+        e.width_before = img.width();
+        e.height_before = img.height();
+        bool ok;
+        {
+            measure on(e);
+            trace::span t("script", plan[index].name.c_str(),
+                          trace::enabled() ? plan[index].describe() : std::string());
+            ok = execute(plan[index], out);
+        }
+        e.pixels = touched;
+        e.width_after = img.width();
+        e.height_after = img.height();
+        record(index, e);
+        return ok;
+    }
+
+    void script::process(std::ostream& out) {
+        trace::span t("script", "script", filename);
+        memory::scope in(mem);
+        pixel_pool::scope from(pool);
+        compile();
+        try {
+            for (size_t i = 0; i < plan.size(); ) {
+                // sequência de comandos até ao próximo open ou blank
+                size_t end = i + 1;
+                while (end < plan.size() && plan[end].type != command::OPEN && plan[end].type != command::BLANK) {
+                    end++;
+                }
+                if (band_rows > 0 && streamable(i, end)) {
+                    if (!stream(i, end, out)) {
+                        break;
+                    }
+                    i = end;
+                    continue;
+                }
+                if (!run(i, out)) {
+                    break;
+                }
+                i++;
             }
+        } catch (const std::bad_alloc&) {
+            // orçamento de memória (memory::account::set_budget()) ultrapassado, ou memória esgotada
+            out << "Not enough memory (" << (memory::total().live() >> 20) << " MiB of images in use)! Stopping ..."
+                << std::endl;
+        }
+    }
+
+    void script::announce(const command& c, std::ostream& out) const {
+        if (c.type == command::FUSED) {
+            out << "Executing " << c.describe() << " ..." << std::endl;
+        } else {
+            out << "Executing command '" << c.name << "' ..." << std::endl;
+        }
+    }
+
+    bool script::streamable(size_t begin, size_t end) const {
+        if (plan[begin].type != command::OPEN && plan[begin].type != command::BLANK) {
+            return false;
+        }
+        for (size_t k = begin + 1; k < end; k++) {
+            command::kind t = plan[k].type;
+            if (t == command::CROP || t == command::ROTATE || t == command::OPEN || t == command::BLANK) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool script::stream(size_t begin, size_t end, std::ostream& out) {
+        const command& first = plan[begin];
+        int w0 = img.width(), h0 = img.height();
+        //medições de cada comando, somadas ao longo das bandas
+        std::vector<profile::entry> use(end);
 
-            if (command == "save") {
-                save();
-            } else if (command == "fill") {
-                fill();
-            }
-
-            // Transformações sem segunda imagem
-            if(command == "invert"){
-                img -> invert();
-            } else if(command == "to_gray_scale"){
-                img -> to_gray_scale();
-            } else if(command == "replace"){
-                color a;
-                color b;
-                input >> a >> b;
-                //int r1, g1, b1, r2, g2, b2;
-                //input >> r1 >> g1 >> b2 >> r2 >> g2 >> b2;
-                //color a = (const color &) color(r1, g1, b1);
-                //color b = (const color &) color(r2, g2, b2);
-                img -> replace(a, b);
-            } else if(command == "crop"){
-                int x, y, w, h;
-                input >> x >> y >> w >> h;
-                img -> crop(x, y, w, h);
-            } else if(command == "rotate_left"){
-                img -> rotate_left();
-            } else if(command == "rotate_right"){
-                img -> rotate_right();
-            }
-
-            //Transformações com segunda imagem
-            if(command == "mix"){
-                //carregamento da segunda imagem
-                std::string filename;
-                input >> filename;
-                image* img2 = png::load(root_path + "/" + filename);
-                //processo
-                int f;
-                input >> f;
-                img -> mix(*img2, f);
-            } else if(command == "add"){
-                //carregamento da segunda imagem
-                std::string filename;
-                input >> filename;
-                image* img2 = png::load(root_path + "/" + filename);
-                //processo
-                color n;
-                int x, y;
-                input >> n >> x >> y;
-                img -> add(*img2, n, x, y);
-                //img2->~image();
-            }
-        }
-    }
-    void script::open() {
-        if (img != NULL) {
-            // Delete previous image
-            delete img;
-        }
-        std::string filename;
-        input >> filename;
-        img = png::load(root_path + "/" + filename);
-    }
-    void script::blank() {
-        if (img != NULL) {
-            // Delete previous image
-            delete img;
-        }
-        int w, h;
-        color c;
-        input >> w >> h >> c;
-        img = new image(w, h, c);
-    }
-    void script::save() {
-        std::string filename;
-        input >> filename;
-        png::save(root_path + "/" + filename, img);
-    }
-    void script::fill() {
-        int x, y, w, h;
-        color c;
-        input >> x >> y >> w >> h >> c;
-        img -> fill(x, y, w, h, c);
+        // De onde vêm as linhas: QOI, PPM e PAM são lidos por bandas; os PNG, os JPEG
+        // e as reduções são descodificados inteiros, mas fora da cache, para a imagem
+        // ser libertada no fim da sequência
+        std::unique_ptr<png::reader> file;
+        std::shared_ptr<const image> whole;
+        int w = first.w, h = first.h;
+        {
+            measure on(use[begin]);
+            trace::span t("script", first.name.c_str(), trace::enabled() ? first.describe() : std::string());
+            announce(first, out);
+            img = image();
+            if (first.type == command::OPEN) {
+                int scale;
+                if (!parse_scale(first.options, scale)) {
+                    out << "Unknown open options '" << first.options << "'! Stopping ..." << std::endl;
+                    return false;
+                }
+                std::string path = root_path + "/" + first.file;
+                if (scale == 1) {
+                    file.reset(png::open_reader(path));
+                }
+                if (file) {
+                    w = file -> width();
+                    h = file -> height();
+                } else {
+                    whole.reset(png::load(path, scale));
+                    if (whole) {
+                        w = whole -> width();
+                        h = whole -> height();
+                    }
+                }
+            }
+        }
+        if (first.type == command::OPEN && !file && !whole) {
+            use[begin].width_before = w0;
+            use[begin].height_before = h0;
+            record(begin, use[begin]);
+            // sem imagem, o comando seguinte para o script, como em execute()
+            for (size_t k = begin + 1; k < end; k++) {
+                if (!run(k, out)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Prepara os comandos: segundas imagens e ficheiros de saída
+        std::map<std::string, std::shared_ptr<const image> > operands;
+        std::vector<std::shared_ptr<png::writer> > writers(end);
+        size_t last = begin + 1;
+        bool ok = true;
+        for ( ; last < end && ok; last++) {
+            measure on(use[last]);
+            const command& c = plan[last];
+            announce(c, out);
+            std::vector<const command*> mixes;
+            if (c.type == command::MIX || c.type == command::ADD) {
+                mixes.push_back(&c);
+            }
+            for (const command& s : c.steps) {
+                if (s.type == command::MIX) {
+                    mixes.push_back(&s);
+                }
+            }
+            for (const command* m : mixes) {
+                std::shared_ptr<const image>& img2 = operands[m -> file];
+                if (!img2) {
+                    img2 = cache.load(root_path + "/" + m -> file);
+                }
+                if (!img2) {
+                    out << "Could not load " << m -> file << "! Stopping ..." << std::endl;
+                    ok = false;
+                    break;
+                }
+            }
+            if (c.type == command::SAVE) {
+                png::options opts;
+                std::string path = root_path + "/" + c.file;
+                if (c.options.empty()) {
+                    writers[last].reset(png::open_writer(path, w, h));
+                } else if (png::options::parse(c.options, opts)) {
+                    writers[last].reset(png::open_writer(path, w, h, opts));
+                } else {
+                    out << "Unknown save options '" << c.options << "'! Stopping ..." << std::endl;
+                    ok = false;
+                }
+            }
+        }
+        if (!ok) {
+            last--; // o comando que falhou não é executado
+        }
+
+        // Executa os comandos preparados, banda a banda
+        int rows = std::min(band_rows, h);
+        std::unique_ptr<image> buffer;
+        for (int y0 = 0; y0 < h; y0 += rows) {
+            int n = std::min(rows, h - y0);
+            {
+                measure on(use[begin]);
+                trace::span t("script", "read band");
+                if (!buffer || n < buffer -> height()) {
+                    buffer.reset(new image(w, n, image::allocate((size_t) w * n)));
+                }
+                color* p = buffer -> data();
+                if (file) {
+                    if (!file -> read(p, n)) {
+                        out << "Could not read " << first.file << "! Stopping ..." << std::endl;
+                        return false;
+                    }
+                } else if (whole) {
+                    image_view v = whole -> view();
+                    for (int r = 0; r < n; r++) {
+                        std::copy(v.row(y0 + r), v.row(y0 + r) + w, p + (size_t) r * w);
+                    }
+                } else {
+                    std::fill(p, p + (size_t) w * n, first.a);
+                }
+                use[begin].pixels += (unsigned long long) w * n;
+            }
+            image& band = *buffer;
+            for (size_t k = begin + 1; k < last; k++) {
+                const command& c = plan[k];
+                measure on(use[k]);
+                trace::span t("script", c.name.c_str());
+                unsigned long long& pixels = use[k].pixels;
+                // as segundas imagens contribuem com as linhas da banda
+                if (c.type == command::INVERT) {
+                    band.invert();
+                    pixels += (unsigned long long) w * n;
+                } else if (c.type == command::TO_GRAY_SCALE) {
+                    band.to_gray_scale();
+                    pixels += (unsigned long long) w * n;
+                } else if (c.type == command::REPLACE) {
+                    band.replace(c.a, c.b);
+                    pixels += (unsigned long long) w * n;
+                } else if (c.type == command::FILL) {
+                    band.fill(c.x, c.y - y0, c.w, c.h, c.a);
+                    pixels += area(c.x, c.w, w, c.y - y0, c.h, n);
+                } else if (c.type == command::ADD) {
+                    const image& img2 = *operands[c.file];
+                    band.add(img2.view(), c.a, c.x, c.y - y0);
+                    pixels += area(c.x, img2.width(), w, c.y - y0, img2.height(), n);
+                } else if (c.type == command::MIX) {
+                    const image& img2 = *operands[c.file];
+                    if (y0 < img2.height()) {
+                        band.mix(img2.view(0, y0, img2.width(), std::min(n, img2.height() - y0)), c.factor);
+                        pixels += area(0, img2.width(), w, 0, img2.height() - y0, n);
+                    }
+                } else if (c.type == command::FUSED) {
+                    std::vector<pixel_op> ops;
+                    for (const command& s : c.steps) {
+                        if (s.type == command::INVERT) {
+                            ops.push_back(pixel_op::invert());
+                        } else if (s.type == command::TO_GRAY_SCALE) {
+                            ops.push_back(pixel_op::to_gray_scale());
+                        } else if (s.type == command::REPLACE) {
+                            ops.push_back(pixel_op::replace(s.a, s.b));
+                        } else if (s.type == command::MIX) {
+                            const image& img2 = *operands[s.file];
+                            if (y0 < img2.height()) {
+                                ops.push_back(pixel_op::mix(img2.view(0, y0, img2.width(), std::min(n, img2.height() - y0)),
+                                                            s.factor));
+                            }
+                        }
+                    }
+                    band.apply(ops);
+                    pixels += (unsigned long long) w * n;
+                } else if (c.type == command::SAVE && writers[k]) {
+                    writers[k] -> write(band.view());
+                    pixels += (unsigned long long) w * n;
+                }
+            }
+        }
+        for (size_t k = begin + 1; k < last; k++) {
+            if (writers[k]) {
+                measure on(use[k]);
+                trace::span t("script", "close", plan[k].file);
+                writers[k] -> close();
+            }
+        }
+        for (size_t k = begin; k < last + (ok ? 0 : 1); k++) {
+            use[k].width_before = k == begin ? w0 : w;
+            use[k].height_before = k == begin ? h0 : h;
+            use[k].width_after = w;
+            use[k].height_after = h;
+            record(k, use[k]);
+        }
+        return ok;
+    }
+
+    bool script::execute(const command& c, std::ostream& out) {
+        announce(c, out);
+        touched = 0;
+
+        if (c.type == command::OPEN) {
+            if (!open(c)) {
+                out << "Unknown open options '" << c.options << "'! Stopping ..." << std::endl;
+                return false;
+            }
+        } else if (c.type == command::BLANK) {
+            blank(c);
+        }
+
+        // Other commands
+        if (img.empty()) {
+            out << "No image loaded! Stopping ..." << std::endl;
+            return false;
+        }
+        //pixeis lidos ou escritos pelas operações sobre a imagem toda
+        unsigned long long all = (unsigned long long) img.width() * img.height();
+        if (c.type == command::OPEN || c.type == command::BLANK || c.type == command::SAVE ||
+            c.type == command::INVERT || c.type == command::TO_GRAY_SCALE || c.type == command::REPLACE ||
+            c.type == command::FUSED) {
+            touched = all;
+        } else if (c.type == command::FILL) {
+            touched = area(c.x, c.w, img.width(), c.y, c.h, img.height());
+        } else if (c.type == command::CROP) {
+            //dentro da imagem o crop só muda a janela sobre os pixeis
+            touched = area(c.x, c.w, img.width(), c.y, c.h, img.height()) ==
+                      (unsigned long long) c.w * c.h ? 0 : (unsigned long long) c.w * c.h;
+        }
+
+        if (c.type == command::SAVE) {
+            if (!save(c)) {
+                out << "Unknown save options '" << c.options << "'! Stopping ..." << std::endl;
+                return false;
+            }
+        } else if (c.type == command::FILL) {
+            fill(c);
+        }
+
+        // Transformações sem segunda imagem
+        if (c.type == command::INVERT) {
+            img.invert();
+        } else if (c.type == command::TO_GRAY_SCALE) {
+            img.to_gray_scale();
+        } else if (c.type == command::REPLACE) {
+            img.replace(c.a, c.b);
+        } else if (c.type == command::CROP) {
+            img.crop(c.x, c.y, c.w, c.h);
+        } else if (c.type == command::ROTATE) {
+            if (c.turns == 3) {
+                img.rotate_left();
+            } else {
+                for (int i = 0; i < c.turns; i++) {
+                    img.rotate_right();
+                }
+            }
+        }
+
+        //Transformações com segunda imagem
+        if (c.type == command::MIX || c.type == command::ADD) {
+            //a segunda imagem vem da cache e é libertada por ela
+            std::shared_ptr<const image> img2 = cache.load(root_path + "/" + c.file);
+            if (img2 == NULL) {
+                out << "Could not load " << c.file << "! Stopping ..." << std::endl;
+                return false;
+            }
+            if (c.type == command::MIX) {
+                touched = area(0, img2 -> width(), img.width(), 0, img2 -> height(), img.height());
+                img.mix(*img2, c.factor);
+            } else {
+                touched = area(c.x, img2 -> width(), img.width(), c.y, img2 -> height(), img.height());
+                img.add(*img2, c.a, c.x, c.y);
+            }
+        }
+
+        //Passagem única com vários comandos por pixel
+        if (c.type == command::FUSED) {
+            std::vector<pixel_op> ops;
+            for (const command& s : c.steps) {
+                if (s.type == command::INVERT) {
+                    ops.push_back(pixel_op::invert());
+                } else if (s.type == command::TO_GRAY_SCALE) {
+                    ops.push_back(pixel_op::to_gray_scale());
+                } else if (s.type == command::REPLACE) {
+                    ops.push_back(pixel_op::replace(s.a, s.b));
+                } else if (s.type == command::MIX) {
+                    // a vista partilha o buffer da imagem guardada na cache
+                    std::shared_ptr<const image> img2 = cache.load(root_path + "/" + s.file);
+                    if (img2 == NULL) {
+                        out << "Could not load " << s.file << "! Stopping ..." << std::endl;
+                        return false;
+                    }
+                    ops.push_back(pixel_op::mix(img2 -> view(), s.factor));
+                }
+            }
+            img.apply(ops);
+        }
+        return true;
+    }
+
+    bool script::open(const command& c) {
+        int scale;
+        if (!parse_scale(c.options, scale)) {
+            return false;
+        }
+        // liberta a imagem anterior antes de ler a nova
+        img = image();
+        std::shared_ptr<const image> loaded = cache.load(root_path + "/" + c.file, scale);
+        if (loaded) {
+            // partilha os pixeis da cache até à primeira alteração
+            img = image(loaded -> view());
+        }
+        return true;
+    }
+    void script::blank(const command& c) {
+        // liberta a imagem anterior antes de reservar a nova
+        img = image();
+        img = image(c.w, c.h, c.a);
+    }
+    bool script::save(const command& c) {
+        if (c.options.empty()) {
+            png::save(root_path + "/" + c.file, img.view());
+            return true;
+        }
+        png::options opts;
+        if (!png::options::parse(c.options, opts)) {
+            return false;
+        }
+        png::save(root_path + "/" + c.file, img.view(), opts);
+        return true;
+    }
+    void script::fill(const command& c) {
+        img.fill(c.x, c.y, c.w, c.h, c.a);
     }
 }
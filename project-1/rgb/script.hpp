@@ -1,42 +1,218 @@
-
 //! @file script.hpp
 #ifndef __rgb_script_hpp__
 #define __rgb_script_hpp__
 
 #include <fstream>
+#include <iostream>
+#include <vector>
 #include <rgb/image.hpp>
+#include <rgb/image_cache.hpp>
+#include <rgb/memory.hpp>
+#include <rgb/pixel_pool.hpp>
+#include <rgb/profile.hpp>
 
 namespace rgb {
     class script {
     private:
+        //! Comando do script, já com os argumentos lidos
+        struct command {
+            //! Tipos de comando
+            //!
+            //! ROTATE representa uma ou mais rotações seguidas e FUSED uma sequência
+            //! de comandos por pixel que é executada numa só passagem
+            enum kind { OPEN, BLANK, SAVE, FILL, INVERT, TO_GRAY_SCALE, REPLACE, CROP,
+                        ROTATE, MIX, ADD, FUSED, UNKNOWN };
+            //! Campo para guardar o tipo do comando
+            kind type;
+            //! Campo para guardar o nome do comando, tal como aparece no script
+            std::string name;
+            //! Campo para guardar o ficheiro (open, save, mix, add)
+            std::string file;
+            //! Campo para guardar as opções do resto da linha: redução (open, por
+            //! exemplo "scale 1/4") ou codificador PNG (save, por exemplo "fast")
+            std::string options;
+            //! Campos para guardar posição e dimensões (blank, fill, crop, add)
+            int x, y, w, h;
+            //! Campo para guardar o fator (mix)
+            int factor;
+            //! Campo para guardar o número de rotações de 90º para a direita (ROTATE, 1 a 3)
+            int turns;
+            //! Campos para guardar as cores (blank, fill, add: a; replace: a e b)
+            color a, b;
+            //! Campo para guardar os comandos de uma passagem FUSED
+            std::vector<command> steps;
+            //! Campo para guardar o número de comandos do script que este comando representa
+            int merged;
+            //! Construtor de um comando sem argumentos
+            //!
+            //! \param type tipo do comando
+            //! \param name nome do comando
+            command(kind type, const std::string& name);
+            //! Verifica se o comando altera cada pixel sem depender dos vizinhos
+            //!
+            //! \return true para invert, to_gray_scale, replace e mix
+            bool per_pixel() const;
+            //! Obtem o comando na sintaxe dos scripts
+            //!
+            //! \return texto do comando
+            std::string describe() const;
+        };
+        //! Função para ler o próximo comando do script
+        //!
+        //! \param c comando lido
+        //! \return false se o script terminou
+        bool parse(command& c);
+        //! Função para acrescentar um comando ao plano, simplificando-o com os anteriores
+        //!
+        //! anula pares invert/invert, junta rotações seguidas (módulo 4) e repetições de
+        //! to_gray_scale, e elimina replace de uma cor por ela própria; os comandos antes
+        //! do primeiro open/blank ficam como estão, para pararem o script com o mesmo erro
+        //! \param c comando a acrescentar
+        void push(const command& c);
+        //! Função para juntar sequências de comandos por pixel em passagens FUSED
+        //!
+        //! (só depois do primeiro open/blank, tal como as simplificações de push())
+        void fuse();
+        //! Função para escrever a mensagem de início de um comando
+        //!
+        //! \param c comando
+        //! \param out stream onde escrever
+        void announce(const command& c, std::ostream& out) const;
+        //! Verifica se os comandos plan[begin, end) podem ser executados por bandas
+        //!
+        //! \return true se plan[begin] for open ou blank e os outros comandos só usarem
+        //! as linhas que alteram: invert, to_gray_scale, replace, fill, mix, add e save
+        bool streamable(size_t begin, size_t end) const;
+        //! Função para executar os comandos plan[begin, end) por bandas de linhas
+        //!
+        //! lê band_rows linhas da imagem de cada vez, aplica-lhes todos os comandos e
+        //! passa-as aos saves, que escrevem os ficheiros à medida; a imagem nunca está
+        //! toda em memória (PNG, JPEG e reduções são descodificados inteiros, sem
+        //! passar pela cache, mas as alterações continuam a ser feitas só na banda)
+        //! \param begin posição do open ou blank no plano
+        //! \param end posição do comando a seguir ao último da sequência
+        //! \param out stream onde escrever as mensagens
+        //! \return false se o script deve parar
+        bool stream(size_t begin, size_t end, std::ostream& out);
+        //! Função para executar um comando do plano e registar as medições no perfil
+        //!
+        //! \param index posição do comando no plano
+        //! \param out stream onde escrever as mensagens
+        //! \return false se o script deve parar
+        bool run(size_t index, std::ostream& out);
+        //! Função para acrescentar ao perfil (se houver) as medições de um comando
+        //!
+        //! \param index posição do comando no plano
+        //! \param e medições (o script, a posição e o comando são preenchidos aqui)
+        void record(size_t index, profile::entry e);
+        //! Função para executar um comando do plano
+        //!
+        //! \param c comando a executar
+        //! \param out stream onde escrever as mensagens
+        //! \return false se o script deve parar
+        bool execute(const command& c, std::ostream& out);
         //! Função para preencher uma imagem a partir da posição (x,y) com uma cor
         //! através do uso da função membro image::fill()
-        void fill();
+        void fill(const command& c);
         //! Função para inicializar uma certa imagem
-        void open();
+        //!
+        //! \return false se as opções de redução não forem válidas
+        bool open(const command& c);
         //! Função para criar e preencher uma imagem com uma cor
         //! através do uso do construtor de imagem
-        void blank();
+        void blank(const command& c);
         //! Função para guardar uma certa imagem png
-        void save();
+        //!
+        //! \return false se as opções do codificador não forem válidas
+        bool save(const command& c);
     public:
         //! Construtor de um script
         //!
         //! \param filename string com o nome do ficheiro para ler o script
-        script(const std::string& filename);
+        //! \param cache cache de onde vêm as imagens lidas por open, mix e add
+        script(const std::string& filename, image_cache& cache = image_cache::shared());
         //! Destrutor de um script
         //!
         //! liberta o espaço alocado para o script
         ~script();
+        //! Função para ler o script todo e construir o plano otimizado
+        //!
+        //! é chamada por process() se ainda não tiver sido chamada
+        void compile();
+        //! Função para escrever o plano otimizado, sem o executar
+        //!
+        //! \param out stream onde escrever
+        void explain(std::ostream& out);
+        //! Função para passar a executar o script por bandas de linhas
+        //!
+        //! cada sequência open (ou blank) ... save em que os comandos só alteram as
+        //! linhas em que mexem (invert, to_gray_scale, replace, fill, mix e add) é lida,
+        //! alterada e gravada rows linhas de cada vez, com memória proporcional a
+        //! largura x rows em vez de ao tamanho da imagem; as sequências com crop ou
+        //! rotações continuam a ser executadas com a imagem toda. Os saves sem opções
+        //! usam o codificador incluído (png::open_writer()) em vez do stb
+        //! \param rows número de linhas de cada banda (0 executa tudo com a imagem toda)
+        void set_band_rows(int rows);
+        //! Função para passar a medir cada operação do plano
+        //!
+        //! o tempo, os pixeis lidos ou escritos, a memória reservada e as dimensões
+        //! da imagem antes e depois de cada operação são acrescentados a p
+        //! \param p perfil onde acrescentar as medições (NULL para não medir)
+        void set_profile(profile* p);
+        //! Função para limitar a memória de imagens do script
+        //!
+        //! um comando que ultrapasse o limite para o script com "Not enough memory",
+        //! como o orçamento de todo o processo (memory::total()), mas só conta os
+        //! buffers deste script (memory_usage())
+        //! \param bytes máximo de bytes de pixeis vivos (0 para não haver limite)
+        void set_memory_budget(size_t bytes);
+        //! Função para obter a conta de memória do script
+        //!
+        //! os buffers de pixeis reservados durante process(), incluindo os das faixas
+        //! executadas por outras threads (parallel::for_rows()), são atribuídos a esta
+        //! conta; as imagens descodificadas pela cache são da conta da cache
+        //! \return bytes vivos, pico e número de reservas
+        const memory::account& memory_usage() const;
+        //! Função para obter a reserva de buffers do script
+        //!
+        //! durante process() as imagens usam esta reserva, por isso os buffers
+        //! libertados por um comando (crop, rotações, open, blank) são reutilizados
+        //! pelos seguintes
+        //! \return reserva de buffers
+        const pixel_pool& buffers() const;
         //! Função para processar os vários comandos presentes num script
-        void process();
+        //!
+        //! \param out stream onde escrever as mensagens de cada comando
+        void process(std::ostream& out = std::cout);
     private:
         //! Campo para guardar a imagem principal
-        image* img;
+        image img;
+        //! Campo para guardar o nome do ficheiro do script
+        std::string filename;
         //! Campo para guardar o objeto de input
         std::ifstream input;
         //! Campo para guardar o diretório do input
         std::string root_path;
+        //! Campo para guardar a cache de imagens descodificadas
+        image_cache& cache;
+        //! Campo para guardar o plano (comandos depois de otimizados)
+        std::vector<command> plan;
+        //! Campo para guardar o número de comandos lidos do script
+        int parsed;
+        //! Campo para indicar se o script já foi compilado
+        bool compiled;
+        //! Campo para indicar se o plano já tem um comando que cria a imagem (open ou blank)
+        bool opened;
+        //! Campo para guardar o número de linhas de cada banda (0 se não for por bandas)
+        int band_rows;
+        //! Campo para guardar o perfil onde são registadas as medições (NULL se não houver)
+        profile* prof;
+        //! Campo para guardar o número de pixeis lidos ou escritos pelo último execute()
+        unsigned long long touched;
+        //! Campo para guardar a conta de memória do script
+        std::shared_ptr<memory::account> mem;
+        //! Campo para guardar a reserva de buffers do script
+        std::shared_ptr<pixel_pool> pool;
     };
 }
 #endif
@@ -0,0 +1,157 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <rgb/trace.hpp>
+
+namespace rgb {
+    namespace trace {
+        std::atomic<bool> on(false);
+
+        namespace {
+            //! Um intervalo terminado
+            struct event {
+                std::string category;
+                std::string name;
+                std::string detail;
+                double begin;
+                double duration;
+            };
+
+            //! Intervalos de uma thread, com o seu número e nome
+            struct track {
+                int id;
+                std::string name;
+                std::mutex m;
+                std::vector<event> events;
+            };
+
+            std::mutex tracks_m;
+            std::vector<std::shared_ptr<track> > tracks;
+            //! Origem dos tempos (o último start()), em ticks do steady_clock; é atómica
+            //! porque start() pode ser chamada enquanto outras threads fecham intervalos
+            std::atomic<std::chrono::steady_clock::rep> origin(
+                    std::chrono::steady_clock::now().time_since_epoch().count());
+
+            thread_local std::shared_ptr<track> mine;
+            thread_local std::string my_name;
+
+            double now() {
+                std::chrono::steady_clock::duration since(std::chrono::steady_clock::now().time_since_epoch().count() -
+                                                          origin.load());
+                return std::chrono::duration<double, std::micro>(since).count();
+            }
+
+            //! Faixa da thread atual, criada na primeira utilização
+            track& current() {
+                if (!mine) {
+                    std::lock_guard<std::mutex> lock(tracks_m);
+                    mine = std::make_shared<track>();
+                    mine->id = (int) tracks.size() + 1;
+                    mine->name = my_name.empty() ? "thread " + std::to_string(mine->id) : my_name;
+                    tracks.push_back(mine);
+                }
+                return *mine;
+            }
+        }
+
+        void start() {
+            std::lock_guard<std::mutex> lock(tracks_m);
+            for (const auto& t : tracks) {
+                std::lock_guard<std::mutex> events(t->m);
+                t->events.clear();
+            }
+            origin = std::chrono::steady_clock::now().time_since_epoch().count();
+            on = true;
+        }
+
+        void stop() {
+            on = false;
+        }
+
+        void name_thread(const std::string& name) {
+            my_name = name;
+            if (mine) {
+                std::lock_guard<std::mutex> lock(tracks_m);
+                mine->name = name;
+            }
+        }
+
+        void write(std::ostream& out) {
+            std::lock_guard<std::mutex> lock(tracks_m);
+            std::ios_base::fmtflags flags = out.flags();
+            out << std::fixed << std::setprecision(3);
+            out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+            out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"rgb\"}}";
+            for (const auto& t : tracks) {
+                std::lock_guard<std::mutex> events(t->m);
+                out << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t->id
+                    << ", \"args\": {\"name\": ";
+                json_string(out, t->name);
+                out << "}}";
+                for (const event& e : t->events) {
+                    out << ",\n  {\"name\": ";
+                    json_string(out, e.name);
+                    out << ", \"cat\": ";
+                    json_string(out, e.category);
+                    out << ", \"ph\": \"X\", \"ts\": " << e.begin << ", \"dur\": " << e.duration
+                        << ", \"pid\": 1, \"tid\": " << t->id;
+                    if (!e.detail.empty()) {
+                        out << ", \"args\": {\"detail\": ";
+                        json_string(out, e.detail);
+                        out << "}";
+                    }
+                    out << "}";
+                }
+            }
+            out << "\n]}" << std::endl;
+            out.flags(flags);
+        }
+
+        span::span(const char* category, const char* name) :
+            category(category), name(name), begin(enabled() ? now() : -1) {}
+
+        span::span(const char* category, const char* name, const std::string& detail) :
+            category(category), name(name), begin(-1) {
+            if (enabled()) {
+                this->detail = detail;
+                begin = now();
+            }
+        }
+
+        span::~span() {
+            if (begin < 0 || !enabled()) {
+                return;
+            }
+            event e;
+            e.begin = begin;
+            e.duration = now() - begin;
+            e.category = category;
+            e.name = name;
+            e.detail.swap(detail);
+            track& t = current();
+            std::lock_guard<std::mutex> lock(t.m);
+            t.events.push_back(e);
+        }
+    }
+
+    void json_string(std::ostream& out, const std::string& s) {
+        out << '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if ((unsigned char) c < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", (unsigned char) c);
+                out << code;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+}
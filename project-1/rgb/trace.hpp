@@ -0,0 +1,77 @@
+//! @file trace.hpp
+#ifndef __rgb_trace_hpp__
+#define __rgb_trace_hpp__
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+namespace rgb {
+    //! Linha temporal da execução, no formato "trace event" do Chrome (run_script --trace)
+    //!
+    //! os intervalos (trace::span) abertos enquanto o registo está ligado são
+    //! guardados por thread e escritos em JSON por write(), uma faixa por thread,
+    //! para abrir no Perfetto ou em chrome://tracing. Desligado, um intervalo
+    //! custa a leitura de uma variável atómica
+    namespace trace {
+        //! Campo para guardar se o registo está ligado (usar enabled())
+        extern std::atomic<bool> on;
+        //! Liga o registo, descartando os intervalos guardados antes
+        //!
+        //! os tempos passam a contar a partir daqui; pode ser chamada com intervalos
+        //! abertos noutras threads (esses ficam com o início relativo à origem anterior)
+        void start();
+        //! Desliga o registo; os intervalos guardados mantêm-se até ao próximo start()
+        void stop();
+        //! Indica se o registo está ligado
+        //!
+        //! \return true se os intervalos abertos agora são guardados
+        inline bool enabled() {
+            return on.load(std::memory_order_relaxed);
+        }
+        //! Dá um nome à faixa da thread atual (por omissão "thread N")
+        //!
+        //! pode ser chamada antes de start()
+        //! \param name nome da thread
+        void name_thread(const std::string& name);
+        //! Escreve os intervalos guardados em JSON ("traceEvents")
+        //!
+        //! \param out stream onde escrever
+        void write(std::ostream& out);
+
+        //! Intervalo de tempo com nome, desde a construção até à destruição
+        class span {
+        public:
+            //! Construtor
+            //!
+            //! \param category categoria do intervalo (por exemplo "image" ou "png")
+            //! \param name nome do intervalo; tem de existir até à destruição do span
+            span(const char* category, const char* name);
+            //! Construtor com um detalhe (por exemplo o ficheiro ou o comando)
+            //!
+            //! \param category categoria do intervalo
+            //! \param name nome do intervalo; tem de existir até à destruição do span
+            //! \param detail texto mostrado nos argumentos do intervalo
+            span(const char* category, const char* name, const std::string& detail);
+            //! Destrutor: guarda o intervalo, se o registo estava ligado na construção
+            ~span();
+            span(const span&) = delete;
+            span& operator=(const span&) = delete;
+        private:
+            //! Campos para guardar a categoria e o nome
+            const char* category;
+            const char* name;
+            //! Campo para guardar o detalhe
+            std::string detail;
+            //! Campo para guardar o início, em microssegundos (negativo se o registo estava desligado)
+            double begin;
+        };
+    }
+
+    //! Escreve uma string JSON, com as aspas e os caracteres especiais escapados
+    //!
+    //! \param out stream onde escrever
+    //! \param s texto
+    void json_string(std::ostream& out, const std::string& s);
+}
+#endif
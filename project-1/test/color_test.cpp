@@ -1,3 +1,4 @@
+#include <cstring>
 #include <gtest/gtest.h>
 #include <rgb/rgb.hpp>
 
@@ -21,6 +22,15 @@ TEST(color, copy_constructor) {
     color c2 = c;
     assert_color_is(c2, 1, 2, 3);
 }
+TEST(color, packed) {
+    static_assert(std::is_trivially_copyable<color>::value, "color is copied with memcpy");
+    static_assert(color(1, 2, 3).packed() == 0x030201, "packed() is constexpr");
+    color c(1, 2, 3), c2;
+    memcpy(&c2, &c, sizeof(color));
+    ASSERT_EQ(3u, sizeof(color));
+    assert_color_is(c2, 1, 2, 3);
+    ASSERT_EQ(0xFFFFFFu, color::WHITE.packed());
+}
 TEST(color, set) {
     color c;
     c.red() = 1;
@@ -1,6 +1,14 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <thread>
 #include <gtest/gtest.h>
 #include <rgb/rgb.hpp>
+#include <rgb/kernels.hpp>
+#include <rgb/parallel.hpp>
+#include <rgb/pixel_pool.hpp>
 
 using namespace rgb;
 
@@ -47,3 +55,368 @@ TEST(image, set) {
         }
     }
 }
+
+// Imagem com dimensões que não são múltiplas dos blocos SIMD
+void random_image(image& img, unsigned seed) {
+    std::default_random_engine rng(seed);
+    std::uniform_int_distribution<int> distribution(0,255);
+    for (int x = 0; x < img.width(); x++) {
+        for (int y = 0; y < img.height(); y++) {
+            img.at(x, y) = color((rgb_value) distribution(rng),
+                                 (rgb_value) distribution(rng),
+                                 (rgb_value) distribution(rng));
+        }
+    }
+}
+TEST(image, kernels_match_color) {
+    image a(37, 23), b(37, 23);
+    random_image(a, 1);
+    random_image(b, 2);
+    for (int level = kernels::SCALAR; level <= kernels::best_isa(); level++) {
+        kernels::use_isa((kernels::isa) level);
+        const char* name = kernels::isa_name((kernels::isa) level);
+        for (int f : { 0, 1, 37, 50, 99, 100, -20, 150 }) {
+            image inverted(37, 23), gray(37, 23), mixed(37, 23);
+            random_image(inverted, 1);
+            random_image(gray, 1);
+            random_image(mixed, 1);
+            inverted.invert();
+            gray.to_gray_scale();
+            mixed.mix(b, f);
+            for (int x = 0; x < a.width(); x++) {
+                for (int y = 0; y < a.height(); y++) {
+                    color c = a.at(x, y);
+                    c.invert();
+                    ASSERT_EQ(c, inverted.at(x, y)) << name;
+                    c = a.at(x, y);
+                    c.to_gray_scale();
+                    ASSERT_EQ(c, gray.at(x, y)) << name;
+                    c = a.at(x, y);
+                    c.mix(b.at(x, y), f);
+                    ASSERT_EQ(c, mixed.at(x, y)) << name << " f=" << f;
+                }
+            }
+        }
+    }
+    kernels::use_isa(kernels::best_isa());
+}
+TEST(image, threads_match_single_thread) {
+    image src(701, 403), op(97, 61);
+    random_image(src, 3);
+    random_image(op, 4);
+    std::unique_ptr<image> results[2];
+    for (int k = 0; k < 2; k++) {
+        parallel::set_threads(k == 0 ? 1 : 4);
+        results[k].reset(new image(701, 403));
+        image* img = results[k].get();
+        img->add(src, color(1, 2, 3), 0, 0);
+        img->invert();
+        img->mix(src, 40);
+        img->replace(img->at(5, 5), color::RED);
+        img->fill(10, 20, 300, 200, color::BLUE);
+        img->add(op, op.at(0, 0), 50, 60);
+        img->rotate_right();
+        img->to_gray_scale();
+        img->rotate_left();
+        img->rotate_left();
+    }
+    parallel::set_threads(0);
+    ASSERT_EQ(results[0]->width(), results[1]->width());
+    ASSERT_EQ(results[0]->height(), results[1]->height());
+    for (int x = 0; x < results[0]->width(); x++) {
+        for (int y = 0; y < results[0]->height(); y++) {
+            ASSERT_EQ(results[0]->at(x, y), results[1]->at(x, y));
+        }
+    }
+}
+TEST(image, colors_from_own_pixels) {
+    // as cores podem ser pixeis da própria imagem: as faixas usam o valor antes da operação
+    parallel::set_threads(4);
+    image img(300, 400, color::BLUE);
+    img.replace(img.at(0, 0), color::RED);
+    for (int y = 0; y < img.height(); y++) {
+        for (int x = 0; x < img.width(); x++) {
+            ASSERT_EQ(color::RED, img.at(x, y));
+        }
+    }
+    image over(300, 400, color::RED);
+    over.fill(0, 200, 300, 200, color::GREEN);
+    img.add(over, img.at(0, 399), 0, 0);
+    parallel::set_threads(0);
+    for (int y = 0; y < img.height(); y++) {
+        for (int x = 0; x < img.width(); x++) {
+            ASSERT_EQ(y < 200 ? color::RED : color::GREEN, img.at(x, y));
+        }
+    }
+}
+TEST(image, band_exceptions_reach_caller) {
+    // uma exceção numa faixa de outra thread é relançada na thread que chamou for_rows()
+    parallel::set_threads(4);
+    std::atomic<int> rows(0);
+    ASSERT_THROW(parallel::for_rows(1000, 1 << 20, [&](int y0, int y1) {
+        if (y0 <= 500 && 500 < y1) {
+            throw std::runtime_error("band");
+        }
+        rows += y1 - y0;
+    }), std::runtime_error);
+    ASSERT_LT(rows.load(), 1000);
+    // as threads continuam a funcionar depois
+    rows = 0;
+    parallel::for_rows(1000, 1 << 20, [&](int y0, int y1) {
+        rows += y1 - y0;
+    });
+    ASSERT_EQ(1000, rows.load());
+    parallel::set_threads(0);
+}
+TEST(image, bands_use_caller_account) {
+    // os buffers reservados nas faixas das outras threads contam na conta de quem chamou for_rows()
+    parallel::set_threads(4);
+    std::shared_ptr<memory::account> account(new memory::account());
+    std::atomic<int> bands(0), others(0), wrong(0);
+    std::thread::id caller = std::this_thread::get_id();
+    {
+        memory::scope in(account);
+        parallel::for_rows(1000, 1 << 20, [&](int y0, int y1) {
+            if (std::this_thread::get_id() != caller) {
+                others++;
+            } else if (y0 == 0) {
+                // a primeira faixa espera que outra thread execute alguma
+                std::chrono::steady_clock::time_point limit = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                while (others.load() == 0 && std::chrono::steady_clock::now() < limit) {
+                    std::this_thread::yield();
+                }
+            }
+            if (memory::current() != account) {
+                wrong++;
+            }
+            std::shared_ptr<color> pixels = image::allocate((size_t) (y1 - y0) * 10);
+            bands++;
+        });
+    }
+    parallel::set_threads(0);
+    ASSERT_LT(0, others.load());
+    ASSERT_EQ(0, wrong.load());
+    ASSERT_EQ((unsigned long long) bands.load(), account->allocations());
+    ASSERT_EQ(0u, account->live());
+}
+TEST(image, fill_clipped) {
+    image img(20, 10);
+    img.fill(-5, 7, 10, 100, color::RED);
+    for (int x = 0; x < img.width(); x++) {
+        for (int y = 0; y < img.height(); y++) {
+            ASSERT_EQ(x < 5 && y >= 7 ? color::RED : color::WHITE, img.at(x, y));
+        }
+    }
+}
+TEST(image, add_clipped) {
+    image img(20, 10), over(8, 6, color::BLUE);
+    over.at(0, 0) = color::WHITE;
+    img.add(over, color::WHITE, 15, -2);
+    for (int x = 0; x < img.width(); x++) {
+        for (int y = 0; y < img.height(); y++) {
+            ASSERT_EQ(x >= 15 && y < 4 ? color::BLUE : color::WHITE, img.at(x, y));
+        }
+    }
+}
+TEST(image, rotate_odd_sizes) {
+    image src(70, 45);
+    random_image(src, 5);
+    image right = src.clone(), left = src.clone();
+    right.rotate_right();
+    left.rotate_left();
+    ASSERT_EQ(45, right.width());
+    ASSERT_EQ(70, right.height());
+    ASSERT_EQ(45, left.width());
+    ASSERT_EQ(70, left.height());
+    for (int x = 0; x < src.width(); x++) {
+        for (int y = 0; y < src.height(); y++) {
+            ASSERT_EQ(src.at(x, y), right.at(src.height() - 1 - y, x));
+            ASSERT_EQ(src.at(x, y), left.at(y, src.width() - 1 - x));
+        }
+    }
+}
+TEST(image, crop_shares_pixels) {
+    image img(30, 20);
+    random_image(img, 6);
+    const image& cimg = img;
+    const color* before = cimg.data();
+    img.crop(3, 4, 10, 5);
+    ASSERT_EQ(10, img.width());
+    ASSERT_EQ(5, img.height());
+    ASSERT_EQ(before + 4 * 30 + 3, cimg.data());
+    ASSERT_EQ(30, img.stride());
+}
+TEST(image, view_copy_on_write) {
+    image img(30, 20);
+    random_image(img, 7);
+    image part(img.view(2, 3, 5, 4));
+    part.invert();
+    for (int x = 0; x < part.width(); x++) {
+        for (int y = 0; y < part.height(); y++) {
+            color c = img.at(x + 2, y + 3);
+            c.invert();
+            ASSERT_EQ(c, part.at(x, y));
+        }
+    }
+    image_view v = img.view();
+    img.fill(0, 0, 30, 20, color::RED);
+    ASSERT_NE(color::RED, v.at(4, 4));
+    assert_all_pixels_are(img, color::RED);
+}
+TEST(image, apply_matches_sequential) {
+    image a(1500, 9), b(1200, 7);
+    random_image(a, 8);
+    random_image(b, 9);
+    color target = a.at(3, 3);
+    target.invert();
+    image sequential(a.view()), fused(a.view());
+    sequential.invert();
+    sequential.replace(target, color::GREEN);
+    sequential.mix(b, 30);
+    sequential.to_gray_scale();
+    fused.apply({ pixel_op::invert(),
+                  pixel_op::replace(target, color::GREEN),
+                  pixel_op::mix(b.view(), 30),
+                  pixel_op::to_gray_scale() });
+    for (int x = 0; x < a.width(); x++) {
+        for (int y = 0; y < a.height(); y++) {
+            ASSERT_EQ(sequential.at(x, y), fused.at(x, y));
+        }
+    }
+}
+TEST(image, pipeline_matches_sequential) {
+    image a(301, 57);
+    random_image(a, 10);
+    color target = a.at(5, 7);
+    target.invert();
+    // direita, com rotação pendente e recortada (linhas não consecutivas)
+    for (int k = 0; k < 3; k++) {
+        image sequential(a.view()), fused(a.view());
+        if (k == 1) {
+            sequential.rotate_right();
+            fused.rotate_right();
+        } else if (k == 2) {
+            sequential.crop(10, 3, 200, 40);
+            fused.crop(10, 3, 200, 40);
+        }
+        sequential.invert();
+        sequential.replace(target, color::GREEN);
+        sequential.mix(image(sequential.width(), sequential.height(), color(9, 99, 199)), 30);
+        sequential.to_gray_scale();
+        for (int x = 0; x < sequential.width(); x++) {
+            for (int y = 0; y < sequential.height(); y++) {
+                sequential.at(x, y).red() ^= 1;
+            }
+        }
+        fused.apply(pipeline::invert() | pipeline::replace(target, color::GREEN) |
+                    pipeline::mix(color(9, 99, 199), 30) | pipeline::to_gray_scale() |
+                    pipeline::each([](color& c) { c.red() ^= 1; }));
+        ASSERT_EQ(sequential.width(), fused.width());
+        for (int x = 0; x < sequential.width(); x++) {
+            for (int y = 0; y < sequential.height(); y++) {
+                ASSERT_EQ(sequential.at(x, y), fused.at(x, y)) << k;
+            }
+        }
+    }
+}
+TEST(image, rotations_are_lazy) {
+    image src(40, 30);
+    random_image(src, 10);
+    image img(src.view());
+    img.data();
+    const image& cimg = img;
+    const color* before = cimg.data();
+    img.rotate_right();
+    img.fill(2, 3, 5, 6, color::RED);
+    img.crop(1, 2, 20, 25);
+    img.rotate_left();
+    ASSERT_EQ(25, img.width());
+    ASSERT_EQ(20, img.height());
+    // nenhum pixel foi movido: a imagem é uma janela sobre o buffer original
+    ASSERT_EQ(before + 9 * 40 + 2, cimg.data());
+    for (int x = 0; x < img.width(); x++) {
+        for (int y = 0; y < img.height(); y++) {
+            int a = 20 - y, b = x + 2;
+            bool filled = a >= 2 && a < 7 && b >= 3 && b < 9;
+            ASSERT_EQ(filled ? color::RED : src.at(b, 29 - a), img.at(x, y));
+        }
+    }
+}
+
+TEST(image, adopts_buffer) {
+    int released = 0;
+    {
+        color* raw = new color[6];
+        raw[4] = color::RED;
+        std::shared_ptr<color> pixels(raw, [&released](color* p) { released++; delete [] p; });
+        image img(3, 2, pixels);
+        pixels.reset();
+        const image& cimg = img;
+        // sem cópia: a imagem usa o próprio buffer que recebeu
+        ASSERT_EQ(raw, cimg.data());
+        ASSERT_EQ(color::RED, img.at(1, 1));
+        img.invert();
+        ASSERT_EQ(raw, cimg.data());
+        ASSERT_EQ(0, released);
+    }
+    ASSERT_EQ(1, released);
+}
+
+TEST(image, pooled_buffers) {
+    ASSERT_EQ(4096u, pixel_pool::size_class(1));
+    ASSERT_EQ(10240u, pixel_pool::size_class(9000));
+    ASSERT_EQ(3u << 20, pixel_pool::size_class((3u << 20) - 5));
+    std::shared_ptr<pixel_pool> pool = std::make_shared<pixel_pool>();
+    const color* first;
+    {
+        pixel_pool::scope from(pool);
+        image a(100, 50, color::RED);
+        first = static_cast<const image&>(a).data();
+        // uma rotação materializada liberta o buffer antigo, que o seguinte reutiliza
+        a.rotate_right();
+        a.data();
+        image b(50, 100, color::BLUE);
+        ASSERT_EQ(first, static_cast<const image&>(b).data());
+        assert_all_pixels_are(b, color::BLUE);
+        assert_all_pixels_are(a, color::RED);
+    }
+    ASSERT_EQ(1u, pool->reused());
+    ASSERT_EQ(2u, pool->fresh());
+    ASSERT_EQ(2u * pixel_pool::size_class(100 * 50 * 3), pool->idle());
+    // fora do scope as imagens não usam a reserva
+    image c(100, 50);
+    ASSERT_EQ(2u, pool->fresh());
+}
+
+TEST(image, value_semantics) {
+    image a(4, 3, color::RED);
+    const color* pixels = static_cast<const image&>(a).data();
+    // mover não copia pixeis e deixa a origem vazia
+    image b(std::move(a));
+    ASSERT_TRUE(a.empty());
+    ASSERT_EQ(0, a.width());
+    ASSERT_EQ(pixels, static_cast<const image&>(b).data());
+    image c;
+    ASSERT_TRUE(c.empty());
+    c = std::move(b);
+    ASSERT_TRUE(b.empty());
+    ASSERT_EQ(pixels, static_cast<const image&>(c).data());
+    // clone() copia já com a rotação aplicada e fica independente
+    c.at(1, 0) = color::BLUE;
+    c.rotate_right();
+    image d = c.clone();
+    ASSERT_TRUE(d.is_upright());
+    ASSERT_EQ(3, d.width());
+    ASSERT_EQ(4, d.height());
+    ASSERT_EQ(color::BLUE, d.at(2, 1));
+    d.invert();
+    ASSERT_EQ(color::BLUE, c.at(2, 1));
+    // swap troca tudo, incluindo a orientação
+    image e(2, 2, color::GREEN);
+    swap(c, e);
+    ASSERT_EQ(2, c.width());
+    ASSERT_EQ(color::GREEN, c.at(1, 1));
+    ASSERT_EQ(3, e.width());
+    ASSERT_EQ(color::BLUE, e.at(2, 1));
+    ASSERT_FALSE(e.is_upright());
+}
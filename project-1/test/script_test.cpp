@@ -1,5 +1,12 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <gtest/gtest.h>
 #include <rgb/rgb.hpp>
+#include <png/jpeg.hpp>
+#include <rgb/batch.hpp>
+#include <rgb/parallel.hpp>
+#include <rgb/trace.hpp>
 
 using namespace rgb;
 const std::string root_path = ROOT_PROJ_DIR;
@@ -12,19 +19,24 @@ protected:
         e_img = o_img = NULL;
     }
     void TearDown() override {
-        if (e_img != NULL) {
-            delete e_img;
-        }
-        if (o_img != NULL) {
-            delete o_img;
-        }
+        release_images();
+    }
+    // Liberta as imagens de uma comparação anterior (check() pode ser chamada várias vezes por teste)
+    void release_images() {
+        delete e_img;
+        delete o_img;
+        e_img = o_img = NULL;
     }
     void execute(std::string id) {
         std::string script_file = root_path + "/scripts/" + id + ".txt";
-        std::string output = root_path + "/output/" + id + ".png";
-        std::string expected = root_path + "/expected/" + id + ".png";
         script s(script_file);
         s.process();
+        check(id);
+    }
+    void check(std::string id) {
+        std::string output = root_path + "/output/" + id + ".png";
+        std::string expected = root_path + "/expected/" + id + ".png";
+        release_images();
         e_img = png::load(expected);
         ASSERT_TRUE(e_img != NULL);
         o_img = png::load(output);
@@ -185,4 +197,682 @@ TEST_F(script_test, extra3) {
 }
 TEST_F(script_test, extra4) {
     execute("extra4");
-}
\ No newline at end of file
+}
+TEST_F(script_test, explain_extra1) {
+    // 6 rotações e 2 inversões anulam-se; os dois replace ficam numa só passagem
+    script s(root_path + "/scripts/extra1.txt");
+    std::ostringstream plan;
+    s.explain(plan);
+    std::string first_line = plan.str().substr(0, plan.str().find('\n'));
+    ASSERT_NE(std::string::npos, first_line.find("14 commands -> 5 operations"));
+    ASSERT_NE(std::string::npos, plan.str().find("fused pass (replace 255 255 255 0 0 0; replace 0 0 0 255 255 255)"));
+}
+TEST_F(script_test, no_image_not_simplified) {
+    // antes de open os pares invert/invert não se anulam: o primeiro invert para o script
+    std::string script_file = root_path + "/output/no_image.txt";
+    {
+        std::ofstream out(script_file);
+        out << "invert\ninvert\nopen input/lion.png\nsave output/no_image.png\n";
+    }
+    script s(script_file);
+    std::ostringstream plan;
+    s.explain(plan);
+    ASSERT_NE(std::string::npos, plan.str().find("4 commands -> 4 operations")) << plan.str();
+    std::ostringstream log;
+    s.process(log);
+    ASSERT_NE(std::string::npos, log.str().find("No image loaded! Stopping ...")) << log.str();
+    ASSERT_EQ(std::string::npos, log.str().find("'open'")) << log.str();
+    std::remove(script_file.c_str());
+}
+TEST_F(script_test, cache_add4) {
+    // lion.png é usada três vezes mas só é descodificada uma vez
+    image_cache cache;
+    script s(root_path + "/scripts/add4.txt", cache);
+    s.process();
+    ASSERT_EQ(2u, cache.misses());
+    ASSERT_EQ(2u, cache.hits());
+}
+TEST_F(script_test, cache_lru) {
+    std::string files[3];
+    for (int i = 0; i < 3; i++) {
+        image tmp(4, 4, i == 0 ? color::RED : i == 1 ? color::GREEN : color::BLUE);
+        files[i] = root_path + "/output/cache_lru" + std::to_string(i) + ".png";
+        png::save(files[i], &tmp);
+    }
+    // cabem duas imagens de 4x4: a menos usada sai quando entra a terceira
+    image_cache cache(2 * 4 * 4 * 3);
+    std::shared_ptr<const image> first = cache.load(files[0]);
+    cache.load(files[1]);
+    ASSERT_EQ(first, cache.load(files[0]));
+    cache.load(files[2]);
+    ASSERT_EQ(cache.budget(), cache.used());
+    ASSERT_EQ(first, cache.load(files[0]));
+    ASSERT_EQ(3u, cache.misses());
+    cache.load(files[1]);
+    ASSERT_EQ(4u, cache.misses());
+    // a imagem continua válida para quem a tem, mesmo fora da cache
+    cache.clear();
+    ASSERT_EQ(0u, cache.used());
+    ASSERT_EQ(color::RED, first->at(3, 3));
+    ASSERT_TRUE(cache.load(root_path + "/input/missing.png") == NULL);
+    for (int i = 0; i < 3; i++) {
+        std::remove(files[i].c_str());
+    }
+}
+TEST_F(script_test, cache_reloads_changed_file) {
+    std::string file = root_path + "/output/cache_test.png";
+    image_cache cache;
+    image blue(4, 2, color::BLUE);
+    png::save(file, &blue);
+    ASSERT_EQ(color::BLUE, cache.load(file)->at(0, 0));
+    image red(3, 2, color::RED);
+    png::save(file, &red);
+    ASSERT_EQ(color::RED, cache.load(file)->at(0, 0));
+    ASSERT_EQ(2u, cache.misses());
+    std::remove(file.c_str());
+}
+TEST_F(script_test, batch_ordered_output) {
+    // mix e add partilham input/lion.png através da cache
+    const char* ids[] = { "add4", "mix1", "rotate3", "extra2", "add1", "crop6", "mix4" };
+    std::vector<std::string> files;
+    for (const char* id : ids) {
+        files.push_back(root_path + "/scripts/" + id + ".txt");
+    }
+    std::ostringstream out;
+    batch::run(files, 3, out);
+    for (const char* id : ids) {
+        check(id);
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::ostringstream alone;
+        script s(files[i]);
+        s.process(alone);
+        std::string block = "==> " + files[i] + " <==\n" + alone.str();
+        ASSERT_EQ(block, out.str().substr(pos, block.size()));
+        pos += block.size();
+    }
+    ASSERT_EQ(out.str().size(), pos);
+}
+TEST_F(script_test, save_options) {
+    png::options opts;
+    ASSERT_TRUE(png::options::parse("fast", opts));
+    ASSERT_EQ("level 1 filter up", opts.describe());
+    ASSERT_TRUE(png::options::parse("best level 4 filter paeth", opts));
+    ASSERT_EQ("level 4 filter paeth", opts.describe());
+    ASSERT_FALSE(png::options::parse("level 12", opts));
+    ASSERT_FALSE(png::options::parse("quick", opts));
+    ASSERT_EQ("level 4 filter paeth", opts.describe());
+
+    // todas as combinações têm de voltar a dar os mesmos pixeis
+    std::unique_ptr<image> lion(png::load(root_path + "/input/lion.png"));
+    image tiny(1, 1, color::RED);
+    std::string file = root_path + "/output/save_options.png";
+    for (int level = 0; level <= 9; level += 3) {
+        for (int f = png::FILTER_NONE; f <= png::FILTER_ADAPTIVE; f++) {
+            png::options o(level, (png::filter_type) f);
+            const image_view views[] = { lion->view(), lion->view(17, 30, 101, 77), tiny.view() };
+            for (const image_view& v : views) {
+                png::save(file, v, o);
+                std::unique_ptr<image> back(png::load(file));
+                ASSERT_TRUE(back != NULL) << o.describe();
+                ASSERT_EQ(v.width(), back->width());
+                ASSERT_EQ(v.height(), back->height());
+                for (int y = 0; y < v.height(); y++) {
+                    for (int x = 0; x < v.width(); x++) {
+                        ASSERT_EQ(v.at(x, y), back->at(x, y)) << o.describe();
+                    }
+                }
+            }
+        }
+    }
+    std::remove(file.c_str());
+}
+TEST_F(script_test, save_fast_script) {
+    std::string script_file = root_path + "/output/save_fast.txt";
+    {
+        std::ofstream out(script_file);
+        out << "open input/lion.png\nsave output/open_save1.png fast\n";
+    }
+    script s(script_file);
+    std::ostringstream plan;
+    s.explain(plan);
+    ASSERT_NE(std::string::npos, plan.str().find("save output/open_save1.png fast\n"));
+    s.process();
+    check("open_save1");
+    std::remove(script_file.c_str());
+    // volta a gravar com o codificador por omissão
+    execute("open_save1");
+}
+TEST_F(script_test, save_segments_independent_of_threads) {
+    // jungle.png dá vários segmentos; o ficheiro não pode depender das threads
+    std::unique_ptr<image> jungle(png::load(root_path + "/input/jungle.png"));
+    std::string file = root_path + "/output/save_segments.png";
+    std::string bytes[2];
+    for (int run = 0; run < 2; run++) {
+        parallel::set_threads(run == 0 ? 1 : 4);
+        png::save(file, jungle.get(), png::options::fast());
+        std::ifstream in(file, std::ios::binary);
+        bytes[run].assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    parallel::set_threads(0);
+    ASSERT_EQ(bytes[0], bytes[1]);
+    std::unique_ptr<image> back(png::load(file));
+    ASSERT_TRUE(back != NULL);
+    for (int y = 0; y < jungle->height(); y++) {
+        for (int x = 0; x < jungle->width(); x++) {
+            ASSERT_EQ(jungle->at(x, y), back->at(x, y));
+        }
+    }
+    std::remove(file.c_str());
+}
+TEST_F(script_test, other_formats) {
+    // QOI, PPM e PAM são escolhidos pela extensão e não perdem informação
+    std::unique_ptr<image> lion(png::load(root_path + "/input/lion.png"));
+    const char* extensions[] = { ".qoi", ".ppm", ".PAM" };
+    for (const char* ext : extensions) {
+        std::string file = root_path + "/output/formats" + ext;
+        const image_view views[] = { lion->view(), lion->view(31, 7, 150, 201) };
+        for (const image_view& v : views) {
+            png::save(file, v);
+            std::unique_ptr<image> back(png::load(file));
+            ASSERT_TRUE(back != NULL) << ext;
+            ASSERT_EQ(v.width(), back->width());
+            ASSERT_EQ(v.height(), back->height());
+            for (int y = 0; y < v.height(); y++) {
+                for (int x = 0; x < v.width(); x++) {
+                    ASSERT_EQ(v.at(x, y), back->at(x, y)) << ext;
+                }
+            }
+        }
+        std::remove(file.c_str());
+    }
+}
+TEST_F(script_test, pam_variants) {
+    std::string file = root_path + "/output/variants.pam";
+    {
+        // cinzento com alfa e amostras de 16 bits
+        std::ofstream out(file, std::ios::binary);
+        out << "P7\nWIDTH 2\nHEIGHT 1\nDEPTH 2\nMAXVAL 65535\nTUPLTYPE GRAYSCALE_ALPHA\nENDHDR\n";
+        const unsigned char samples[] = { 0xFF, 0xFF, 0, 0, 0x80, 0x00, 0xFF, 0xFF };
+        out.write(reinterpret_cast<const char*>(samples), sizeof(samples));
+    }
+    std::unique_ptr<image> img(png::load(file));
+    ASSERT_TRUE(img != NULL);
+    ASSERT_EQ(color::WHITE, img->at(0, 0));
+    ASSERT_EQ(color(128, 128, 128), img->at(1, 0));
+    {
+        std::ofstream out(file, std::ios::binary);
+        out << "P6 # comentário\n2 1 255\n" << "abc";
+    }
+    ASSERT_TRUE(png::load(file) == NULL) << "truncated file";
+    std::remove(file.c_str());
+}
+TEST_F(script_test, open_save_qoi) {
+    std::string script_file = root_path + "/output/open_save_qoi.txt";
+    {
+        std::ofstream out(script_file);
+        out << "open input/lion.png\nsave output/open_save_qoi.qoi\n"
+            << "open output/open_save_qoi.qoi\nsave output/open_save1.png\n";
+    }
+    script s(script_file);
+    s.process();
+    check("open_save1");
+    std::remove(script_file.c_str());
+    std::remove((root_path + "/output/open_save_qoi.qoi").c_str());
+}
+TEST_F(script_test, qoi_corrupt_header) {
+    // cabeçalhos sem pixeis: 20000 x 20000 está no limite da especificação mas o
+    // ficheiro não chega para tantos pixeis; 30000 x 30000 passa o limite
+    std::string file = root_path + "/output/corrupt.qoi";
+    for (const char* size : { "\x00\x00\x4E\x20", "\x00\x00\x75\x30" }) {
+        {
+            std::ofstream out(file, std::ios::binary);
+            out.write("qoif", 4);
+            out.write(size, 4);
+            out.write(size, 4);
+            out.write("\x03\x00\x00\x00\x00\x00\x00\x00\x00\x01", 10);
+        }
+        std::unique_ptr<image> img(png::load(file));
+        ASSERT_TRUE(img == NULL);
+    }
+    std::remove(file.c_str());
+}
+TEST_F(script_test, jpeg_scaled) {
+    // a descodificação reduzida no domínio DCT aproxima a média dos blocos da imagem completa
+    std::string file = root_path + "/input/dali.jpg";
+    std::unique_ptr<image> full(png::load(file));
+    ASSERT_TRUE(full != NULL);
+    for (int s = 2; s <= 8; s *= 2) {
+        std::unique_ptr<image> small(png::load(file, s));
+        ASSERT_TRUE(small != NULL);
+        ASSERT_EQ((full->width() + s - 1) / s, small->width());
+        ASSERT_EQ((full->height() + s - 1) / s, small->height());
+        long error = 0;
+        for (int y = 0; y < small->height(); y++) {
+            for (int x = 0; x < small->width(); x++) {
+                int sum[3] = { 0, 0, 0 }, count = 0;
+                for (int j = y * s; j < std::min(y * s + s, full->height()); j++) {
+                    for (int i = x * s; i < std::min(x * s + s, full->width()); i++) {
+                        const color& c = full->at(i, j);
+                        sum[0] += c.red();
+                        sum[1] += c.green();
+                        sum[2] += c.blue();
+                        count++;
+                    }
+                }
+                const color& c = small->at(x, y);
+                error += std::abs(sum[0] / count - c.red()) + std::abs(sum[1] / count - c.green()) +
+                         std::abs(sum[2] / count - c.blue());
+            }
+        }
+        ASSERT_LT(error / (3.0 * small->width() * small->height()), 4.0) << "1/" << s;
+    }
+}
+TEST_F(script_test, jpeg_corrupt) {
+    // dali.jpg: DQT em 55, tabela de Huffman DC em 208 (contagens em 213, valores em 229)
+    std::ifstream in(root_path + "/input/dali.jpg", std::ios::binary);
+    std::string original((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(std::string("\xFF\xDB"), original.substr(55, 2));
+    ASSERT_EQ(std::string("\xFF\xC4\x00\x83\x00\x01\x00\x01\x04", 9), original.substr(208, 9));
+    std::string file = root_path + "/output/corrupt.jpg";
+    for (int k = 0; k < 3; k++) {
+        std::string data = original;
+        if (k == 0) {
+            data[56] = '\xFE'; // sem tabelas de quantização (o DQT passa a comentário)
+        } else if (k == 1) {
+            data[213] = 3;      // três códigos de 1 bit: tabela impossível
+            data[216] = 2;
+        } else {
+            for (int i = 229; i < 239; i++) {
+                data[i] = (char) 200; // diferenças DC de 200 bits
+            }
+        }
+        {
+            std::ofstream out(file, std::ios::binary);
+            out << data;
+        }
+        // png::load() passaria ao descodificador completo: testa-se o reduzido
+        std::unique_ptr<image> img(png::jpeg::load_scaled(file, 2));
+        ASSERT_TRUE(img == NULL) << k;
+    }
+    std::remove(file.c_str());
+}
+TEST_F(script_test, png_scaled) {
+    // outros formatos são reduzidos pela média de cada bloco
+    std::unique_ptr<image> full(png::load(root_path + "/input/lion.png"));
+    std::unique_ptr<image> small(png::load(root_path + "/input/lion.png", 4));
+    ASSERT_EQ((full->width() + 3) / 4, small->width());
+    ASSERT_EQ((full->height() + 3) / 4, small->height());
+    int red = 0;
+    for (int y = 4; y < 8; y++) {
+        for (int x = 8; x < 12; x++) {
+            red += full->at(x, y).red();
+        }
+    }
+    ASSERT_NEAR(red / 16, small->at(2, 1).red(), 1);
+}
+TEST_F(script_test, open_scale) {
+    std::string script_file = root_path + "/output/open_scale.txt";
+    std::string out_file = root_path + "/output/open_scale.png";
+    {
+        std::ofstream out(script_file);
+        out << "open input/dali.jpg scale 1/4\nsave output/open_scale.png\n";
+    }
+    script(script_file).process();
+    std::unique_ptr<image> full(png::load(root_path + "/input/dali.jpg"));
+    std::unique_ptr<image> small(png::load(out_file));
+    ASSERT_TRUE(small != NULL);
+    ASSERT_EQ((full->width() + 3) / 4, small->width());
+    ASSERT_EQ((full->height() + 3) / 4, small->height());
+    std::remove(out_file.c_str());
+    {
+        std::ofstream out(script_file);
+        out << "open input/dali.jpg scale 1/3\nsave output/open_scale.png\n";
+    }
+    std::ostringstream log;
+    script(script_file).process(log);
+    ASSERT_NE(std::string::npos, log.str().find("Unknown open options")) << log.str();
+    std::ifstream saved(out_file);
+    ASSERT_FALSE(saved.good()) << "the script should stop";
+    std::remove(script_file.c_str());
+}
+TEST_F(script_test, mapped_ppm) {
+    // ficheiros PPM grandes são mapeados em memória; alterar a imagem não altera o ficheiro
+    std::string file = root_path + "/output/mapped.ppm";
+    image big(1024, 600, color(10, 20, 30));
+    big.fill(100, 50, 20, 10, color::RED);
+    png::save(file, &big);
+    std::unique_ptr<image> img(png::load(file));
+    ASSERT_TRUE(img != NULL);
+    ASSERT_EQ(1024, img->width());
+    ASSERT_EQ(600, img->height());
+    ASSERT_EQ(color(10, 20, 30), img->at(0, 0));
+    ASSERT_EQ(color::RED, img->at(119, 59));
+    ASSERT_EQ(color(10, 20, 30), img->at(1023, 599));
+    img->invert();
+    ASSERT_EQ(color(245, 235, 225), img->at(0, 0));
+    std::unique_ptr<image> again(png::load(file));
+    ASSERT_EQ(color(10, 20, 30), again->at(0, 0));
+    // gravar por cima do ficheiro mapeado substitui-o sem estragar as imagens abertas
+    png::save(file, img.get());
+    ASSERT_EQ(color(10, 20, 30), again->at(1023, 599));
+    std::unique_ptr<image> saved(png::load(file));
+    ASSERT_EQ(color(245, 235, 225), saved->at(1023, 599));
+    // os pixeis mapeados contam na conta de memória como um buffer reservado
+    std::shared_ptr<memory::account> account(new memory::account());
+    {
+        memory::scope in(account);
+        std::unique_ptr<image> counted(png::load(file));
+        ASSERT_EQ(1024u * 600 * sizeof(color), account->live());
+    }
+    ASSERT_EQ(0u, account->live());
+    ASSERT_EQ(1u, account->allocations());
+    std::remove(file.c_str());
+}
+TEST_F(script_test, scratch_images) {
+    // com ficheiros temporários as operações dão o mesmo resultado que no heap
+    std::unique_ptr<image> lion(png::load(root_path + "/input/lion.png"));
+    image::use_scratch(root_path + "/output", 0);
+    image img(*lion);
+    img.invert();
+    img.rotate_right();
+    img.crop(10, 20, 100, 50);
+    image::use_scratch("", 0);
+    image expected(*lion);
+    expected.invert();
+    expected.rotate_right();
+    expected.crop(10, 20, 100, 50);
+    for (int y = 0; y < expected.height(); y++) {
+        for (int x = 0; x < expected.width(); x++) {
+            ASSERT_EQ(expected.at(x, y), img.at(x, y));
+        }
+    }
+}
+TEST_F(script_test, save_large_png) {
+    // imagens com mais de um lote (8 MiB filtrados) são escritas em vários IDAT
+    std::string file = root_path + "/output/large.png";
+    image big(2048, 1500, color(10, 20, 30));
+    for (int y = 0; y < big.height(); y += 7) {
+        big.fill(y % 2000, y, 48, 3, color(y % 256, 255 - y % 256, 128));
+    }
+    png::options opts;
+    ASSERT_TRUE(png::options::parse("fast", opts));
+    png::save(file, &big, opts);
+    std::unique_ptr<image> back(png::load(file));
+    ASSERT_TRUE(back != NULL);
+    for (int y = 0; y < big.height(); y++) {
+        for (int x = 0; x < big.width(); x++) {
+            ASSERT_EQ(big.at(x, y), back->at(x, y));
+        }
+    }
+    std::remove(file.c_str());
+}
+TEST_F(script_test, stream_scripts) {
+    // por bandas (de 7 linhas, para não coincidirem com nada) os resultados e as mensagens são os mesmos
+    const char* ids[] = { "open_save1", "blank2", "gray1", "invert2", "replace3", "fill2", "fill3",
+                          "mix2", "mix5", "add1", "add4", "add5", "extra1", "extra3", "crop2", "rotate4" };
+    for (const char* id : ids) {
+        std::string file = root_path + "/scripts/" + id + ".txt";
+        std::ostringstream whole, banded;
+        script(file).process(whole);
+        script s(file);
+        s.set_band_rows(7);
+        s.process(banded);
+        ASSERT_EQ(whole.str(), banded.str()) << id;
+        check(id);
+    }
+}
+TEST_F(script_test, stream_formats) {
+    // QOI e PPM são lidos e escritos por bandas, sem a imagem inteira
+    std::string script_file = root_path + "/output/stream_formats.txt";
+    std::unique_ptr<image> lion(png::load(root_path + "/input/lion.png"));
+    png::save(root_path + "/output/stream_lion.qoi", lion.get());
+    {
+        std::ofstream out(script_file);
+        out << "open output/stream_lion.qoi\ninvert\nfill 10 20 30 40 255 0 0\nsave output/stream1.ppm\n"
+            << "mix input/mondrian.png 40\nsave output/stream2.qoi fast\nsave output/stream3.png level 1\n"
+            << "save output/stream4.png bad option\nsave output/stream5.png\n";
+    }
+    std::ostringstream log;
+    script s(script_file);
+    s.set_band_rows(16);
+    s.process(log);
+    ASSERT_NE(std::string::npos, log.str().find("Unknown save options 'bad option'")) << log.str();
+    std::ifstream skipped(root_path + "/output/stream5.png");
+    ASSERT_FALSE(skipped.good()) << "the script should stop";
+
+    std::unique_ptr<image> mondrian(png::load(root_path + "/input/mondrian.png"));
+    image expected(*lion);
+    expected.invert();
+    expected.fill(10, 20, 30, 40, color::RED);
+    std::unique_ptr<image> saved(png::load(root_path + "/output/stream1.ppm"));
+    for (int y = 0; y < expected.height(); y++) {
+        for (int x = 0; x < expected.width(); x++) {
+            ASSERT_EQ(expected.at(x, y), saved->at(x, y));
+        }
+    }
+    expected.mix(*mondrian, 40);
+    const char* mixed[] = { "/output/stream2.qoi", "/output/stream3.png" };
+    for (const char* name : mixed) {
+        saved.reset(png::load(root_path + name));
+        ASSERT_TRUE(saved != NULL) << name;
+        for (int y = 0; y < expected.height(); y++) {
+            for (int x = 0; x < expected.width(); x++) {
+                ASSERT_EQ(expected.at(x, y), saved->at(x, y)) << name;
+            }
+        }
+    }
+    const char* files[] = { "/output/stream_formats.txt", "/output/stream_lion.qoi", "/output/stream1.ppm",
+                            "/output/stream2.qoi", "/output/stream3.png" };
+    for (const char* name : files) {
+        std::remove((root_path + name).c_str());
+    }
+}
+TEST_F(script_test, stream_png_memory) {
+    // um PNG é descodificado inteiro mas fora da cache: o pico é o da imagem e das bandas,
+    // e nada fica vivo depois da sequência
+    std::string script_file = root_path + "/output/stream_png.txt";
+    {
+        std::ofstream out(script_file);
+        out << "open input/jungle.png\ninvert\nsave output/stream_png.png\n";
+    }
+    image_cache cache;
+    std::ostringstream log;
+    script s(script_file, cache);
+    s.set_band_rows(16);
+    s.process(log);
+    std::unique_ptr<image> jungle(png::load(root_path + "/input/jungle.png"));
+    jungle->invert();
+    std::unique_ptr<image> saved(png::load(root_path + "/output/stream_png.png"));
+    ASSERT_TRUE(saved != NULL) << log.str();
+    for (int y = 0; y < jungle->height(); y++) {
+        for (int x = 0; x < jungle->width(); x++) {
+            ASSERT_EQ(jungle->at(x, y), saved->at(x, y));
+        }
+    }
+    size_t bytes = (size_t) jungle->width() * jungle->height() * sizeof(color);
+    ASSERT_LE(bytes, s.memory_usage().peak());
+    ASSERT_GE(bytes + 2u * 16 * jungle->width() * sizeof(color), s.memory_usage().peak());
+    ASSERT_EQ(0u, s.memory_usage().live());
+    ASSERT_EQ(0u, cache.misses());
+
+    // um JPEG reduzido é descodificado inteiro, mas não fica guardado na cache
+    {
+        std::ofstream out(script_file);
+        out << "open input/dali.jpg scale 1/2\nsave output/stream_png.png\n";
+    }
+    script jpeg(script_file, cache);
+    jpeg.set_band_rows(16);
+    jpeg.process(log);
+    saved.reset(png::load(root_path + "/output/stream_png.png"));
+    ASSERT_TRUE(saved != NULL) << log.str();
+    ASSERT_EQ(0u, cache.used());
+    ASSERT_EQ(0u, cache.misses());
+    std::remove(script_file.c_str());
+    std::remove((root_path + "/output/stream_png.png").c_str());
+}
+TEST_F(script_test, profile_commands) {
+    // cada operação fica registada com os pixeis e as dimensões, inteira ou por bandas
+    std::string script_file = root_path + "/output/profile.txt";
+    {
+        std::ofstream out(script_file);
+        out << "open input/lion.png\ninvert\nfill 10 20 30 40 255 0 0\nsave output/profile.png\ncrop 10 20 100 50\n";
+    }
+    for (int rows : { 0, 16 }) {
+        profile prof;
+        std::ostringstream log;
+        script s(script_file);
+        s.set_band_rows(rows);
+        s.set_profile(&prof);
+        s.process(log);
+        std::vector<profile::entry> all = prof.entries();
+        ASSERT_EQ(5u, all.size()) << rows;
+        const char* names[] = { "open", "invert", "fill", "save", "crop" };
+        for (int i = 0; i < 5; i++) {
+            ASSERT_EQ(names[i], all[i].name) << rows;
+            ASSERT_EQ(i, all[i].index);
+            ASSERT_GE(all[i].ms, 0);
+        }
+        ASSERT_EQ(0, all[0].width_before);
+        ASSERT_EQ(250, all[0].width_after);
+        ASSERT_EQ(380, all[0].height_after);
+        ASSERT_EQ(250u * 380, all[1].pixels);
+        ASSERT_EQ(30u * 40, all[2].pixels);
+        ASSERT_EQ(250u * 380, all[3].pixels);
+        ASSERT_EQ(250, all[4].width_before);
+        ASSERT_EQ(100, all[4].width_after);
+        ASSERT_EQ(50, all[4].height_after);
+        std::ostringstream table, json;
+        prof.print_table(table);
+        prof.write_json(json);
+        ASSERT_NE(std::string::npos, table.str().find("invert")) << table.str();
+        ASSERT_NE(std::string::npos, json.str().find("\"command\": \"fill 10 20 30 40 255 0 0\"")) << json.str();
+        ASSERT_NE(std::string::npos, json.str().find("\"total\": {\"operations\": 5")) << json.str();
+    }
+    std::remove(script_file.c_str());
+    std::remove((root_path + "/output/profile.png").c_str());
+}
+TEST_F(script_test, trace_events) {
+    // com o registo ligado ficam intervalos dos comandos, das operações e das leituras/escritas
+    std::string file = root_path + "/scripts/invert1.txt";
+    std::ostringstream log;
+    script(file).process(log);
+    std::ostringstream off;
+    trace::write(off);
+    trace::start();
+    image_cache cache; // vazia, para a imagem ser mesmo lida
+    script(file, cache).process(log);
+    trace::stop();
+    script(file, cache).process(log);
+    std::ostringstream json;
+    trace::write(json);
+    std::string text = json.str();
+    ASSERT_EQ(0u, text.find("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [")) << text;
+    const char* names[] = { "\"name\": \"script\"", "\"name\": \"invert\"", "\"name\": \"image::invert\"",
+                            "\"name\": \"png::load\"", "\"name\": \"png::save\"", "\"ph\": \"X\"", "\"thread_name\"" };
+    for (const char* name : names) {
+        ASSERT_NE(std::string::npos, text.find(name)) << name << "\n" << text;
+    }
+    // o script corrido com o registo desligado não acrescenta nada
+    size_t first = text.find("\"name\": \"script\"");
+    ASSERT_EQ(std::string::npos, text.find("\"name\": \"script\"", first + 1)) << text;
+    ASSERT_EQ(std::string::npos, off.str().find("\"ph\": \"X\"")) << off.str();
+}
+TEST_F(script_test, memory_accounts) {
+    // cada script tem a sua conta; um crop para fora da imagem tem o buffer antigo e o novo vivos ao mesmo tempo
+    std::string script_file = root_path + "/output/memory.txt";
+    {
+        std::ofstream out(script_file);
+        out << "blank 100 100 0 0 0\ncrop -10 -10 200 100\nsave output/memory.png\n";
+    }
+    std::ostringstream log;
+    script s(script_file);
+    s.process(log);
+    const memory::account& used = s.memory_usage();
+    ASSERT_EQ(2u, used.allocations());
+    ASSERT_EQ((100u * 100 + 200u * 100) * sizeof(color), used.peak());
+    ASSERT_EQ(200u * 100 * sizeof(color), used.live()) << "only the cropped image is still alive";
+
+    // com um orçamento menor que o pico o script para no crop
+    memory::total().set_budget(used.peak() + memory::total().live() - 1);
+    std::ostringstream limited;
+    script(script_file).process(limited);
+    memory::total().set_budget(0);
+    ASSERT_NE(std::string::npos, limited.str().find("Not enough memory")) << limited.str();
+    ASSERT_EQ(std::string::npos, limited.str().find("'save'")) << limited.str();
+
+    // o orçamento de um script só conta os buffers desse script
+    std::ostringstream own;
+    script budgeted(script_file);
+    budgeted.set_memory_budget(used.peak() - 1);
+    budgeted.process(own);
+    ASSERT_NE(std::string::npos, own.str().find("Not enough memory")) << own.str();
+    ASSERT_EQ(std::string::npos, own.str().find("'save'")) << own.str();
+    ASSERT_EQ(100u * 100 * sizeof(color), budgeted.memory_usage().peak());
+    std::remove(script_file.c_str());
+    std::remove((root_path + "/output/memory.png").c_str());
+}
+TEST_F(script_test, cache_memory_account) {
+    // as imagens guardadas na cache são da conta da cache, não do primeiro script que as abriu
+    std::string script_file = root_path + "/output/cache_memory.txt";
+    {
+        std::ofstream out(script_file);
+        out << "open input/lion.png\nmix input/mondrian.png 40\nsave output/cache_memory.png\n";
+    }
+    image_cache cache;
+    std::ostringstream log;
+    script first(script_file, cache);
+    first.process(log);
+    ASSERT_EQ(2u, cache.memory_usage().allocations());
+    ASSERT_EQ(cache.used(), cache.memory_usage().live());
+    // o script só reservou a cópia da imagem que alterou
+    std::unique_ptr<image> lion(png::load(root_path + "/input/lion.png"));
+    ASSERT_EQ((size_t) lion->width() * lion->height() * sizeof(color), first.memory_usage().peak());
+    script second(script_file, cache);
+    second.process(log);
+    ASSERT_EQ(2u, cache.memory_usage().allocations());
+    ASSERT_EQ(first.memory_usage().peak(), second.memory_usage().peak());
+    cache.clear();
+    ASSERT_EQ(0u, cache.memory_usage().live());
+    std::remove(script_file.c_str());
+    std::remove((root_path + "/output/cache_memory.png").c_str());
+}
+TEST_F(script_test, pooled_buffers) {
+    // os buffers libertados pelos crops para fora da imagem são reutilizados pelos seguintes
+    std::string script_file = root_path + "/output/pooled.txt";
+    {
+        std::ofstream out(script_file);
+        out << "blank 300 200 0 0 0\n";
+        for (int i = 0; i < 3; i++) {
+            out << "crop -10 -10 320 220\ncrop 10 10 300 200\n";
+        }
+        out << "save output/pooled.ppm\n";
+    }
+    std::ostringstream log;
+    script s(script_file);
+    s.process(log);
+    ASSERT_EQ(1u, s.buffers().reused());
+    std::unique_ptr<image> saved(png::load(root_path + "/output/pooled.ppm"));
+    ASSERT_EQ(300, saved->width());
+    for (int y = 0; y < saved->height(); y++) {
+        for (int x = 0; x < saved->width(); x++) {
+            ASSERT_EQ(color::BLACK, saved->at(x, y));
+        }
+    }
+    std::remove(script_file.c_str());
+    std::remove((root_path + "/output/pooled.ppm").c_str());
+}
+TEST_F(script_test, load_by_value) {
+    image img;
+    ASSERT_TRUE(png::load(root_path + "/input/lion.png", img));
+    std::unique_ptr<image> expected(png::load(root_path + "/input/lion.png"));
+    ASSERT_EQ(expected->width(), img.width());
+    ASSERT_EQ(expected->height(), img.height());
+    ASSERT_EQ(expected->at(120, 200), img.at(120, 200));
+    ASSERT_TRUE(png::load(root_path + "/input/lion.png", 2, img));
+    ASSERT_EQ(125, img.width());
+    // um ficheiro que não existe não altera a imagem
+    ASSERT_FALSE(png::load(root_path + "/input/missing.png", img));
+    ASSERT_EQ(125, img.width());
+}